@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+#include "iconpack.h"
+
+static const char iconPackMagic[8] = { 'Q', 'X', 'K', 'B', 'I', 'C', 'O', 'N' };
+static const int iconPackNameSize = 8;
+static const int iconPackHeaderSize = sizeof(iconPackMagic) + 8;
+static const int iconPackEntrySize = iconPackNameSize + 8;
+
+IconPack::~IconPack()
+{
+    close();
+}
+
+bool IconPack::open(const QString & path)
+{
+    close();
+    file.setFileName(path);
+
+    if(! file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "error open file" << path;
+        return false;
+    }
+
+    size = file.size();
+    data = size < iconPackHeaderSize ? nullptr : file.map(0, size);
+
+    if(! data || 0 != std::memcmp(data, iconPackMagic, sizeof(iconPackMagic)) ||
+        Version != qFromLittleEndian<quint32>(data + 8))
+    {
+        qWarning() << "unknown icon pack format" << path;
+        close();
+        return false;
+    }
+
+    auto count = qFromLittleEndian<quint32>(data + 12);
+
+    if(size < iconPackHeaderSize + (qint64) count * iconPackEntrySize)
+    {
+        qWarning() << "icon pack truncated" << path;
+        close();
+        return false;
+    }
+
+    for(quint32 it = 0; it < count; ++it)
+    {
+        auto entry = data + iconPackHeaderSize + it * iconPackEntrySize;
+        auto name = reinterpret_cast<const char*>(entry);
+        auto offset = qFromLittleEndian<quint32>(entry + iconPackNameSize);
+        auto length = qFromLittleEndian<quint32>(entry + iconPackNameSize + 4);
+
+        if(size < (qint64) offset + length)
+        {
+            qWarning() << "icon pack truncated" << path;
+            close();
+            return false;
+        }
+
+        index.insert(QString::fromLatin1(name, qstrnlen(name, iconPackNameSize)), qMakePair(offset, length));
+    }
+
+    return true;
+}
+
+void IconPack::close(void)
+{
+    if(data)
+        file.unmap(const_cast<uchar*>(data));
+
+    data = nullptr;
+    size = 0;
+    index.clear();
+    file.close();
+}
+
+bool IconPack::isOpen(void) const
+{
+    return data;
+}
+
+QByteArray IconPack::find(const QString & name) const
+{
+    auto it = index.find(name);
+    if(it == index.end())
+        return QByteArray();
+
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(data) + it.value().first, it.value().second);
+}
+
+bool IconPack::write(const QString & path, const QStringList & files)
+{
+    QList<QPair<QByteArray, QByteArray>> icons;
+
+    for(auto & fileName : files)
+    {
+        QFile fs(fileName);
+        if(! fs.open(QIODevice::ReadOnly))
+        {
+            qWarning() << "error open file" << fileName;
+            return false;
+        }
+
+        auto name = QFileInfo(fileName).baseName().toLatin1();
+        if(name.isEmpty() || iconPackNameSize < name.size())
+        {
+            qWarning() << "invalid icon name" << fileName;
+            return false;
+        }
+
+        icons << qMakePair(name, fs.readAll());
+    }
+
+    std::sort(icons.begin(), icons.end());
+
+    QByteArray header(iconPackMagic, sizeof(iconPackMagic));
+    QByteArray index;
+    QByteArray body;
+
+    auto appendU32 = [](QByteArray & buf, quint32 val)
+    {
+        char tmp[4];
+        qToLittleEndian<quint32>(val, tmp);
+        buf.append(tmp, 4);
+    };
+
+    appendU32(header, Version);
+    appendU32(header, icons.size());
+
+    quint32 offset = iconPackHeaderSize + icons.size() * iconPackEntrySize;
+
+    for(auto & icon : icons)
+    {
+        auto name = icon.first;
+        name.append(QByteArray(iconPackNameSize - name.size(), 0));
+
+        index.append(name);
+        appendU32(index, offset + body.size());
+        appendU32(index, icon.second.size());
+
+        body.append(icon.second);
+    }
+
+    QSaveFile fs(path);
+    if(! fs.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "error open file" << path;
+        return false;
+    }
+
+    fs.write(header);
+    fs.write(index);
+    fs.write(body);
+
+    return fs.commit();
+}
@@ -0,0 +1,62 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef ICONPACK_H
+#define ICONPACK_H
+
+#include <QFile>
+#include <QHash>
+#include <QPair>
+#include <QString>
+#include <QByteArray>
+#include <QStringList>
+
+// icon pack file, little endian:
+// header: "QXKBICON", uint32 version, uint32 count
+// index:  count * { char name[8], uint32 offset, uint32 size }
+// data:   png images
+class IconPack
+{
+    QFile file;
+    const uchar* data = nullptr;
+    qint64 size = 0;
+    QHash<QString, QPair<quint32, quint32>> index;
+
+public:
+    enum { Version = 1 };
+
+    IconPack() = default;
+    ~IconPack();
+
+    // memory mapped, shared with other processes through the page cache
+    bool open(const QString & path);
+    void close(void);
+    bool isOpen(void) const;
+
+    // without copy, valid until close
+    QByteArray find(const QString & name) const;
+
+    // name: file base name
+    static bool write(const QString & path, const QStringList & files);
+};
+
+#endif // ICONPACK_H
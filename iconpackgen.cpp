@@ -0,0 +1,41 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QDebug>
+#include <QCoreApplication>
+
+#include "iconpack.h"
+
+// build the icon pack: qxkb5-iconpack <output> <icons.png>...
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    auto args = app.arguments();
+
+    if(args.size() < 3)
+    {
+        qWarning() << "usage:" << args.front() << "<output> <icons>...";
+        return 1;
+    }
+
+    return IconPack::write(args.at(1), args.mid(2)) ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QColor>
+#include <QPainter>
+#include <QStringList>
+
+#include "layoutlabel.h"
+
+QFont layoutLabelFont(const QString & str)
+{
+    // fontName, fontSize, fontWeight
+    auto fontArgs = str.split(", ");
+    QFont font(fontArgs.front());
+
+    if(1 < fontArgs.size())
+        font.setPointSize(fontArgs.at(1).toInt());
+    if(2 < fontArgs.size())
+        font.setWeight((QFont::Weight) fontArgs.at(2).toInt());
+
+    return font;
+}
+
+QImage layoutLabelImage(const QString & label, const QString & font, const QString & background, const QString & color, qreal ratio)
+{
+    QImage image(32 * ratio, 32 * ratio, QImage::Format_RGBA8888);
+    image.setDevicePixelRatio(ratio);
+    image.fill(background == "transparent" ? Qt::transparent : QColor(background));
+
+    QPainter painter(&image);
+    painter.setPen(QColor(color));
+    painter.setFont(layoutLabelFont(font));
+    painter.drawText(QRect(0, 0, 32, 32), Qt::AlignCenter, label);
+
+    return image;
+}
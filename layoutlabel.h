@@ -0,0 +1,36 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef LAYOUTLABEL_H
+#define LAYOUTLABEL_H
+
+#include <QFont>
+#include <QImage>
+#include <QString>
+
+// "Cantarell, 18, 50": family, point size, weight
+QFont layoutLabelFont(const QString &);
+
+// text mode icon: 32x32 at the device ratio, background color or "transparent"
+QImage layoutLabelImage(const QString & label, const QString & font, const QString & background, const QString & color, qreal ratio);
+
+#endif // LAYOUTLABEL_H
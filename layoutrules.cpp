@@ -0,0 +1,110 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <vector>
+#include <algorithm>
+
+#include "layoutrules.h"
+
+QString layoutStateName(int v)
+{
+    if(v == LayoutState::StateFirst)
+        return "first";
+    if(v == LayoutState::StateFixed)
+        return "fixed";
+    if(v == LayoutState::StateNormal)
+        return "normal";
+    return "unknown";
+}
+
+/* LayoutRules */
+LayoutRuleKey LayoutRules::makeKey(const QString & class1, const QString & class2)
+{
+    // the same as Qt::MatchFixedString
+    return LayoutRuleKey(class1.toCaseFolded(), class2.toCaseFolded());
+}
+
+LayoutRule* LayoutRules::find(const QString & class1, const QString & class2)
+{
+    auto it = rules.find(makeKey(class1, class2));
+    return it != rules.end() ? & it.value() : nullptr;
+}
+
+LayoutRule & LayoutRules::insert(const LayoutRule & rule)
+{
+    return rules.insert(makeKey(rule.class1, rule.class2), rule).value();
+}
+
+bool LayoutRules::remove(const QString & class1, const QString & class2)
+{
+    return 0 < rules.remove(makeKey(class1, class2));
+}
+
+void LayoutRules::clear(void)
+{
+    rules.clear();
+}
+
+void LayoutRules::reserve(int count)
+{
+    rules.reserve(count);
+}
+
+QList<LayoutRule> LayoutRules::evict(int capacity, qint64 expired, const LayoutRuleKey & keep)
+{
+    QList<LayoutRule> res;
+    std::vector<QPair<qint64, LayoutRuleKey>> normal;
+
+    for(auto it = rules.begin(); it != rules.end(); ++it)
+    {
+        if(it.value().state != LayoutState::StateNormal || it.key() == keep)
+            continue;
+
+        if(it.value().lastUsed < expired)
+            res << it.value();
+        else
+            normal.emplace_back(it.value().lastUsed, it.key());
+    }
+
+    int excess = 0 < capacity ? rules.size() - res.size() - capacity : 0;
+
+    if(0 < excess)
+    {
+        // down to 90%: not evicted on every insert
+        excess = std::min<int>(normal.size(), excess + capacity / 10);
+        if(excess < (int) normal.size())
+            std::nth_element(normal.begin(), normal.begin() + excess, normal.end());
+
+        for(auto it = normal.begin(); it != normal.begin() + excess; ++it)
+            res << rules.value(it->second);
+    }
+
+    for(auto & rule : res)
+        remove(rule.class1, rule.class2);
+
+    return res;
+}
+
+int LayoutRules::size(void) const
+{
+    return rules.size();
+}
@@ -0,0 +1,74 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef LAYOUTRULES_H
+#define LAYOUTRULES_H
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+enum LayoutState { StateNormal, StateFirst, StateFixed };
+
+QString layoutStateName(int);
+
+// class1, class2 case folded
+typedef QPair<QString, QString> LayoutRuleKey;
+
+struct LayoutRule
+{
+    QString class1;
+    QString class2;
+    // backup title
+    QString title;
+    int layout = 0;
+    int state = LayoutState::StateNormal;
+    // seconds since epoch
+    qint64 lastUsed = 0;
+};
+
+class LayoutRules
+{
+    QHash<LayoutRuleKey, LayoutRule> rules;
+
+public:
+    static LayoutRuleKey makeKey(const QString & class1, const QString & class2);
+
+    // pointer valid until next insert/remove
+    LayoutRule* find(const QString & class1, const QString & class2);
+    LayoutRule & insert(const LayoutRule &);
+    bool remove(const QString & class1, const QString & class2);
+
+    void clear(void);
+    void reserve(int);
+
+    // normal rules: older than expired, and the least recently used over capacity
+    // first/fixed rules and the keep key pinned, the pointers invalid after
+    QList<LayoutRule> evict(int capacity, qint64 expired, const LayoutRuleKey & keep = LayoutRuleKey());
+    int size(void) const;
+
+    QHash<LayoutRuleKey, LayoutRule>::const_iterator begin(void) const { return rules.begin(); }
+    QHash<LayoutRuleKey, LayoutRule>::const_iterator end(void) const { return rules.end(); }
+};
+
+#endif // LAYOUTRULES_H
@@ -26,12 +26,17 @@
 #include <QImage>
 #include <QColor>
 #include <QPainter>
+#include <QTimer>
 #include <QProcess>
 #include <QByteArray>
 #include <QJsonValue>
 #include <QJsonArray>
 #include <QFontDialog>
 #include <QFileDialog>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
 #include <QDataStream>
 #include <QTreeWidget>
 #include <QJsonObject>
@@ -39,13 +44,23 @@
 #include <QColorDialog>
 #include <QJsonDocument>
 #include <QStandardPaths>
+#include <QCryptographicHash>
 #include <QTreeWidgetItem>
 #include <QRegularExpression> 
 
 #include <QDebug>
 #include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <exception>
 
+#include <poll.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "mainsettings.h"
 #include "ui_mainsettings.h"
 
@@ -73,7 +88,7 @@ QString GenericError::toString(const char* func) const
 /* MainSettings */
 MainSettings::MainSettings(const QString & globalConfigPath, QWidget *parent) : QWidget(parent), ui(new Ui::MainSettings)
 {
-    skipClasses << "qxkb5";
+    skipClasses.add("qxkb5");
     actionSettings = new QAction("Settings", this);
     actionExit = new QAction("Exit", this);
 
@@ -92,9 +107,16 @@ MainSettings::MainSettings(const QString & globalConfigPath, QWidget *parent) :
     
     configLoadGlobal(globalConfigPath);
     configLoadLocal();
-    startupProcess();
+
+#ifdef QXKB5_ICONS_PACK
+    if(! iconPack.isOpen())
+        iconPack.open(QXKB5_ICONS_PACK);
+#endif
 
     xcb = new XcbEventsPool(toDebug, this);
+    xcb->setTitleCoalesce(titleCoalesce);
+    xcb->setWindowsTracking(windowsMemory);
+    xcb->setHotkeysAsync(hotkeys);
 
     cacheLoadItems();
 
@@ -107,7 +129,7 @@ MainSettings::MainSettings(const QString & globalConfigPath, QWidget *parent) :
     int index = xcb->getXkbLayout();
 
     trayIcon = new QSystemTrayIcon(this);
-    trayIcon->setIcon(layoutIcons.at(index));
+    trayIconUpdate(index);
     trayIcon->setToolTip(version);
     trayIcon->setContextMenu(menu);
     trayIcon->show();
@@ -135,14 +157,18 @@ MainSettings::MainSettings(const QString & globalConfigPath, QWidget *parent) :
     connect(trayIcon, SIGNAL(activated(QSystemTrayIcon::ActivationReason)), this, SLOT(iconActivated(QSystemTrayIcon::ActivationReason)));
     connect(xcb, SIGNAL(activeWindowNotify(int)), this, SLOT(activeWindowChanged(int)));
     connect(xcb, SIGNAL(windowTitleNotify(int)), this, SLOT(windowTitleChanged(int)));
+    connect(xcb, SIGNAL(windowDestroyNotify(int)), this, SLOT(windowDestroyed(int)));
     connect(xcb, SIGNAL(xkbStateNotify(int)), this, SLOT(xkbStateChanged(int)));
     connect(xcb, SIGNAL(xkbNewKeyboardNotify(int)), this, SLOT(xkbNewKeyboardChanged(int)));
     connect(xcb, SIGNAL(shutdownNotify()), this, SLOT(exitProgram()));
+    connect(xcb, SIGNAL(hotkeyNotify(int)), this, SLOT(hotkeyPressed(int)));
     connect(xcb, SIGNAL(xkbNamesChanged()), this, SLOT(iconAttributeChanged()));
     connect(this, SIGNAL(iconAttributeNotify()), this, SLOT(iconAttributeChanged()));
+    connect(xcb, SIGNAL(xkbNamesChanged()), this, SLOT(xkbRulesCheck()));
+    connect(xcb, SIGNAL(xkbRulesChanged()), this, SLOT(xkbRulesCheck()));
+    connect(xcb, SIGNAL(xkbRulesApplied(bool)), this, SLOT(xkbRulesApplied(bool)));
 
-    if(ui->checkBoxPeriodicCheck->isChecked())
-	periodicCheckXkbRules = startTimer(std::chrono::seconds(2));
+    startupProcess();
 
     // start events pool thread mode
     xcb->start();
@@ -150,33 +176,205 @@ MainSettings::MainSettings(const QString & globalConfigPath, QWidget *parent) :
 
 MainSettings::~MainSettings()
 {
-    windowRestoreTitle(prevWindow);
+    windowRestoreTitle(prevWindow, prevClasses);
     delete ui;
 }
 
+// setxkbmap arguments over the current names: rules, model, layout, variant, options
+static QStringList setxkbmapNames(const QStringList & args, QStringList names)
+{
+    while(names.size() < 5)
+        names << QString();
+
+    if(names.at(0).isEmpty())
+        names[0] = "evdev";
+
+    bool variant = false;
+    int positional = 0;
+
+    for(int it = 0; it < args.size(); ++it)
+    {
+        auto arg = args.at(it);
+
+        if(arg.startsWith('-'))
+        {
+            static const QStringList keys = { "-rules", "-model", "-layout", "-variant", "-option" };
+            auto index = keys.indexOf(arg);
+
+            // unknown option: spawn setxkbmap
+            if(index < 0 || it + 1 >= args.size())
+                return QStringList();
+
+            auto val = args.at(++it);
+            val.remove('"').remove('\'');
+
+            if(index == 2 && ! variant)
+                names[3].clear();
+
+            if(index == 3)
+                variant = true;
+
+            // options appended, empty: reset
+            if(index == 4)
+                names[4] = val.isEmpty() || names.at(4).isEmpty() ? val : names.at(4) + "," + val;
+            else
+                names[index] = val;
+        }
+        else
+        {
+            // layout, variant, options...
+            arg.remove('"').remove('\'');
+
+            if(positional == 0)
+            {
+                names[2] = arg;
+                if(! variant)
+                    names[3].clear();
+            }
+            else
+            if(positional == 1)
+            {
+                names[3] = arg;
+                variant = true;
+            }
+            else
+                names[4] = names.at(4).isEmpty() ? arg : names.at(4) + "," + arg;
+
+            positional++;
+        }
+    }
+
+    return names;
+}
+
 void MainSettings::startupProcess(void)
 {
     if(ui->checkBoxStartup->isChecked() && !ui->lineEditStartup->text().isEmpty())
     {
-        QStringList args = ui->lineEditStartup->text().split(QRegularExpression("\\s+"));
+        // one run only, the repeats coalesced
+        if(startupRunning || ! startupApplying.isEmpty())
+        {
+            startupRepeat = true;
+            return;
+        }
+
+        auto cmdline = ui->lineEditStartup->text();
+        startupRepeat = false;
+
+        QStringList args = cmdline.split(QRegularExpression("\\s+"));
         auto cmd = args.front();
         args.pop_front();
 
-        if(toDebug) {
-            qWarning() << "cmd: " << cmd << args;
+        // setxkbmap: loaded by the server over the xkb connection, without process
+        if(xcb && QFileInfo(cmd).fileName() == "setxkbmap")
+        {
+            auto names = setxkbmapNames(args, xcb->getXkbRulesNames());
+
+            if(! names.isEmpty())
+            {
+                if(toDebug) {
+                    qWarning() << "xkb rules apply:" << names;
+                }
+
+                startupApplying = cmdline;
+                xcb->applyXkbRulesAsync(names);
+                return;
+            }
         }
 
-        QProcess process(this);
-        process.setProgram(cmd);
-        process.setArguments(args);
+        startupSpawn(cmdline);
+    }
+}
+
+void MainSettings::xkbRulesApplied(bool success)
+{
+    auto cmdline = startupApplying;
+    startupApplying.clear();
+
+    if(cmdline.isEmpty())
+        return;
+
+    if(! success)
+    {
+        qWarning() << "xkb rules apply failed, spawn:" << cmdline;
+        startupSpawn(cmdline);
+        return;
+    }
+
+    startupCmd = cmdline;
+    forceReload = false;
+
+    if(startupRepeat)
+        startupProcess();
+    else
+    if(startupCheck)
+    {
+        startupCheck = false;
+        xkbRulesCheck();
+    }
+}
+
+void MainSettings::startupSpawn(const QString & cmdline)
+{
+    QStringList args = cmdline.split(QRegularExpression("\\s+"));
+    auto cmd = args.front();
+    args.pop_front();
+
+    if(toDebug) {
+        qWarning() << "cmd: " << cmd << args;
+    }
+
+    auto process = new QProcess(this);
+    process->setProgram(cmd);
+    process->setArguments(args);
+
+    startupRunning = process;
+
+    connect(process, qOverload<int, QProcess::ExitStatus>(& QProcess::finished),
+        [this, process, cmdline](int code, QProcess::ExitStatus status)
+    {
+        startupFinished(process, cmdline, status == QProcess::NormalExit && code == 0);
+    });
+
+    connect(process, & QProcess::errorOccurred, [this, process](QProcess::ProcessError error)
+    {
+        // finished not emitted
+        if(error == QProcess::FailedToStart)
+            startupFinished(process, nullptr, false);
+    });
 
-        process.start(QIODevice::NotOpen);
+    // kill: finished with crash status
+    QTimer::singleShot(startupTimeout, process, [process](){ process->kill(); });
 
-        if(process.waitForFinished())
-            startupCmd = ui->lineEditStartup->text();
+    process->start(QIODevice::NotOpen);
+}
 
+void MainSettings::startupFinished(QProcess* process, const QString & cmdline, bool success)
+{
+    if(success)
+    {
+        startupCmd = cmdline;
         forceReload = false;
     }
+    else
+    {
+        qWarning() << "startup cmd failed:" << process->program() << process->errorString();
+    }
+
+    if(startupRunning == process)
+        startupRunning = nullptr;
+
+    process->deleteLater();
+
+    // failed: forceReload still set, without the retry loop
+    bool check = startupCheck && success;
+    startupCheck = false;
+
+    if(startupRepeat)
+        startupProcess();
+    else
+    if(check)
+        xkbRulesCheck();
 }
 
 void MainSettings::screenSaverActiveChanged(bool state)
@@ -193,45 +391,60 @@ void MainSettings::keyPressEvent(QKeyEvent* ev)
         {
             if(auto item = ui->treeWidgetCache->currentItem())
             {
-                int index = ui->treeWidgetCache->indexOfTopLevelItem(item);
-                ui->treeWidgetCache->takeTopLevelItem(index);
+                auto class1 = item->text(0);
+                auto class2 = item->text(1);
+
+                cacheRules.remove(class1, class2);
+                cacheJournal.remove(class1, class2);
+                cacheViewRemove(class1, class2);
             }
         }
     }
 }
 
-void MainSettings::timerEvent(QTimerEvent* ev)
+void MainSettings::xkbRulesCheck(void)
 {
-    if(ev->timerId() == periodicCheckXkbRules)
+    if(! xcb || ! ui->checkBoxPeriodicCheck->isChecked())
+        return;
+
+    // the configured layout is applying: forceReload would start it again
+    if(startupRunning || ! startupApplying.isEmpty())
     {
-	QRegularExpression rx("-layout\\s+\"([\\w,]+)");
-	if(auto match = rx.match(ui->lineEditStartup->text()); match.hasMatch())
-	{
-	    auto names1 = match.captured(1).split(",");
-	    auto names2 = xcb->getXkbNames();
+        startupCheck = true;
+        return;
+    }
 
-	    if(toDebug) {
-                qWarning() << "names1: " << names1 << "names2: " << names2;
-            }
+    QStringList args = ui->lineEditStartup->text().split(QRegularExpression("\\s+"));
+    auto cmd = args.front();
+    args.pop_front();
 
-	    if(forceReload || names1.size() != names2.size())
-		startupProcess();
-	}
+    // the same parse as startupProcess: the applied layout is compared
+    if(QFileInfo(cmd).fileName() == "setxkbmap")
+    {
+        // rules, model, layout, variant, options
+        auto rules = xcb->getXkbRulesNames();
+        auto names = setxkbmapNames(args, rules);
+
+        // unknown option: not compared
+        if(names.isEmpty() && ! forceReload)
+            return;
+
+        auto names1 = names.value(2);
+        auto names2 = rules.value(2);
+
+        if(toDebug) {
+            qWarning() << "names1: " << names1 << "names2: " << names2;
+        }
+
+        if(forceReload || names1 != names2)
+            startupProcess();
     }
 }
 
 void MainSettings::periodicChecked(bool f)
 {
     if(f)
-    {
-	killTimer(periodicCheckXkbRules);
-	periodicCheckXkbRules = startTimer(std::chrono::seconds(2));
-    }
-    else
-    if(0 < periodicCheckXkbRules)
-    {
-	killTimer(periodicCheckXkbRules);
-    }
+        xkbRulesCheck();
 }
 
 void MainSettings::exitProgram(void)
@@ -243,11 +456,17 @@ void MainSettings::exitProgram(void)
 void MainSettings::showEvent(QShowEvent* event)
 {
     actionSettings->setDisabled(true);
+
+    cacheViewActive = true;
+    cacheViewReload();
 }
 
 void MainSettings::hideEvent(QHideEvent* event)
 {
     actionSettings->setEnabled(true);
+
+    cacheViewActive = false;
+    cacheViewReload();
 }
 
 void MainSettings::closeEvent(QCloseEvent* event)
@@ -308,8 +527,10 @@ void MainSettings::allowIconsPath(bool)
 void MainSettings::iconAttributeChanged(void)
 {
     initXkbLayoutIcons();
-    int index = xcb->getXkbLayout();
-    trayIcon->setIcon(layoutIcons.at(index));
+    trayIconUpdate(xcb->getXkbLayout());
+
+    // layout names
+    cacheViewReload();
 }
 
 void MainSettings::selectTextColor(void)
@@ -325,12 +546,7 @@ void MainSettings::selectTextColor(void)
 
 void MainSettings::selectFont(void)
 {
-    auto fontArgs = ui->lineEditFont->text().split(", ");
-    QFont font(fontArgs.front());
-    if(1 < fontArgs.size())
-        font.setPointSize(fontArgs.at(1).toInt());
-    if(2 < fontArgs.size())
-        font.setWeight((QFont::Weight) fontArgs.at(2).toInt());
+    auto font = layoutLabelFont(ui->lineEditFont->text());
 
     QFontDialog dialog(this);
     dialog.setCurrentFont(font);
@@ -358,7 +574,7 @@ void MainSettings::selectIconsPath(void)
 void MainSettings::iconActivated(QSystemTrayIcon::ActivationReason reason)
 {
     if(reason == QSystemTrayIcon::Trigger)
-        xcb->switchXkbLayout();
+        xcb->switchXkbLayoutAsync();
 }
 
 void MainSettings::configSave(void)
@@ -534,8 +750,78 @@ bool MainSettings::configLoadGlobal(const QString & jsonPath)
     QString titleFormat = jsonObject.value("title:format").toString();
     ui->lineEditTitleFormat->setText(titleFormat);
 
+    // rules cache: entries, days
+    cacheCapacity = jsonObject.value("cache:capacity").toInt(cacheCapacity);
+    cacheMaxAge = jsonObject.value("cache:maxage").toInt(cacheMaxAge);
+
+    // ms, kill startup cmd
+    startupTimeout = jsonObject.value("startup:timeout").toInt(startupTimeout);
+
+    // ms, 0: without coalesce
+    titleCoalesce = jsonObject.value("title:coalesce").toInt(titleCoalesce);
+
+    QString iconsPack = jsonObject.value("icons:pack").toString();
+    if(! iconsPack.isEmpty())
+        iconPack.open(iconsPack);
+
+    // layout per window, not per class
+    windowsMemory = jsonObject.value("windows:memory").toBool();
+
     for(auto val : jsonObject.value("windows:skip").toArray())
-        skipClasses << val.toString();
+        skipClasses.add(val.toString());
+
+    // [ { "match": "regex", "layout": 1, "state": "fixed" } ]
+    for(auto val : jsonObject.value("title:rules").toArray())
+    {
+        auto jsonRule = val.toObject();
+        auto state = jsonRule.value("state").toString();
+        int layout = jsonRule.value("layout").toInt() - 1;
+
+        // xkb: 4 groups max, the current count checked on switch
+        if(layout < 0 || layout >= 4)
+        {
+            qWarning() << "invalid title rule:" << jsonRule.value("match").toString();
+            continue;
+        }
+
+        titleRules.add(jsonRule.value("match").toString(), layout,
+                state == "fixed" ? LayoutState::StateFixed : (state == "first" ? LayoutState::StateFirst : LayoutState::StateNormal));
+    }
+
+    // "Ctrl+Alt+1": "layout:1", "Super+space": "cycle", "Ctrl+Alt+s": "state"
+    auto jsonHotkeys = jsonObject.value("hotkeys").toObject();
+    for(auto it = jsonHotkeys.begin(); it != jsonHotkeys.end(); ++it)
+    {
+        auto hotkey = XcbHotkey::parse(it.key());
+        auto action = it.value().toString();
+        HotkeyRule rule;
+
+        if(action.startsWith("layout:"))
+        {
+            rule.action = HotkeyAction::HotkeyLayout;
+            rule.layout = action.mid(7).toInt() - 1;
+        }
+        else
+        if(action == "cycle")
+            rule.action = HotkeyAction::HotkeyCycle;
+        else
+        if(action == "state")
+            rule.action = HotkeyAction::HotkeyState;
+        else
+        {
+            qWarning() << "unknown hotkey action:" << action;
+            continue;
+        }
+
+        if(hotkey.keysym == XKB_KEY_NoSymbol || rule.layout < 0)
+        {
+            qWarning() << "invalid hotkey:" << it.key() << action;
+            continue;
+        }
+
+        hotkeys.push_back(hotkey);
+        hotkeyRules << rule;
+    }
 
     bool periodicCheck = jsonObject.value("periodic:check").toBool();
     ui->checkBoxPeriodicCheck->setChecked(periodicCheck);
@@ -545,36 +831,45 @@ bool MainSettings::configLoadGlobal(const QString & jsonPath)
 
 void MainSettings::cacheSaveItems(void)
 {
-    auto localData = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
-    QDir().mkpath(localData);
-    auto cachePath = QDir(localData).absoluteFilePath("cache");
+    cacheItemsEvict(true);
 
-    QFile file(cachePath);
-    if(! file.open(QIODevice::WriteOnly))
-        return;
+    // background compaction, the changes already in journal
+    cacheJournal.compact(cacheRules);
+}
 
-    QDataStream ds(&file);
-    int counts = ui->treeWidgetCache->topLevelItemCount();
-    ds << int(VERSION) << counts;
+void MainSettings::cacheItemsEvict(bool expired, const LayoutRuleKey & keep)
+{
+    qint64 maxAge = 0;
+
+    // days
+    if(expired && 0 < cacheMaxAge)
+        maxAge = QDateTime::currentSecsSinceEpoch() - cacheMaxAge * 86400LL;
 
-    for(int cur = 0; cur < counts; ++cur)
+    for(auto & rule : cacheRules.evict(cacheCapacity, maxAge, keep))
     {
-        auto item = ui->treeWidgetCache->topLevelItem(cur);
-        ds << item->text(0) << item->text(1);
-        ds << item->data(2, Qt::UserRole).toInt();
-        ds << item->data(3, Qt::UserRole).toInt();
+        cacheJournal.remove(rule.class1, rule.class2);
+        cacheViewRemove(rule.class1, rule.class2);
+
+        if(toDebug) {
+            qWarning() << "cache evict:" << rule.class1 << rule.class2;
+        }
     }
 }
 
-QString layoutStateName(int v)
+void MainSettings::cacheItemChanged(const LayoutRule & rule, bool inserted)
 {
-    if(v == LayoutState::StateFirst)
-        return "first";
-    if(v == LayoutState::StateFixed)
-        return "fixed";
-    if(v == LayoutState::StateNormal)
-        return "normal";
-    return "unknown";
+    // one record per change
+    cacheJournal.put(rule);
+
+    if(cacheJournal.compactNeeded(cacheRules.size()))
+        cacheJournal.compact(cacheRules);
+
+    cacheViewUpdate(rule);
+
+    // the size grows on insert only, the new rule kept
+    // the rule reference invalid after
+    if(inserted && 0 < cacheCapacity && cacheCapacity < cacheRules.size())
+        cacheItemsEvict(false, LayoutRules::makeKey(rule.class1, rule.class2));
 }
 
 void setHighlightStatusItem(QTreeWidgetItem* item, int state2)
@@ -592,123 +887,170 @@ void setHighlightStatusItem(QTreeWidgetItem* item, int state2)
 void MainSettings::cacheLoadItems(void)
 {
     auto localData = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
-    QDir().mkpath(localData);
-    auto cachePath = QDir(localData).absoluteFilePath("cache");
+    cacheJournal.load(localData, cacheRules);
 
-    QFile file(cachePath);
-    if(! file.open(QIODevice::ReadOnly))
-        return;
+    cacheItemsEvict(true);
+    cacheViewReload();
+}
 
-    QDataStream ds(&file);
-    ui->treeWidgetCache->clear();
+LayoutRule* MainSettings::cacheFindItem(const QString & class1, const QString & class2)
+{
+    return cacheRules.find(class1, class2);
+}
+
+void MainSettings::cacheViewUpdate(const LayoutRule & rule)
+{
+    if(! cacheViewActive)
+        return;
 
-    int version, counts;
-    ds >> version >> counts;
+    auto key = LayoutRules::makeKey(rule.class1, rule.class2);
+    auto item = cacheViewItems.value(key, nullptr);
 
-    for(int cur = 0; cur < counts; ++cur)
+    if(! item)
     {
-        QString class1, class2;
-        int layout2, state2;
-
-        ds >> class1 >> class2 >> layout2 >> state2;
+        item = new QTreeWidgetItem(QStringList() << rule.class1 << rule.class2);
+        ui->treeWidgetCache->addTopLevelItem(item);
+        cacheViewItems.insert(key, item);
+    }
 
-        auto names = xcb->getXkbNames();
-        if(names.size())
-        {
-            QString layout1 = 0 <= layout2 && names.size() > layout2 ? names.at(layout2) : names.front();
-            QString state1 = layoutStateName(state2);
+    auto names = xcb->getXkbNames();
+    if(names.size())
+    {
+        QString layout1 = 0 <= rule.layout && names.size() > rule.layout ? names.at(rule.layout) : names.front();
+        item->setText(2, layout1);
+    }
 
-            auto item = new QTreeWidgetItem(QStringList() << class1 << class2 << layout1 << state1);
-            item->setData(2, Qt::UserRole, layout2);
-            item->setData(3, Qt::UserRole, state2);
+    item->setText(3, layoutStateName(rule.state));
+    setHighlightStatusItem(item, rule.state);
+}
 
-            setHighlightStatusItem(item, state2);
-            ui->treeWidgetCache->addTopLevelItem(item);
-        }
+void MainSettings::cacheViewRemove(const QString & class1, const QString & class2)
+{
+    if(auto item = cacheViewItems.take(LayoutRules::makeKey(class1, class2)))
+    {
+        int index = ui->treeWidgetCache->indexOfTopLevelItem(item);
+        delete ui->treeWidgetCache->takeTopLevelItem(index);
     }
 }
 
-QTreeWidgetItem* MainSettings::cacheFindItem(const QString & class1, const QString & class2)
+void MainSettings::cacheViewReload(void)
 {
-    auto items1 = ui->treeWidgetCache->findItems(class1, Qt::MatchFixedString, 0);
-    auto items2 = ui->treeWidgetCache->findItems(class2, Qt::MatchFixedString, 1);
-
-    for(auto & item : items1)
-        if(items2.contains(item)) return item;
+    ui->treeWidgetCache->clear();
+    cacheViewItems.clear();
 
-    return nullptr;
+    if(cacheViewActive)
+    {
+        for(auto & rule : cacheRules)
+            cacheViewUpdate(rule);
+    }
 }
 
 void MainSettings::cacheItemClicked(QTreeWidgetItem* item, int column)
 {
+    auto rule = cacheFindItem(item->text(0), item->text(1));
+    if(! rule)
+        return;
+
     // change layout priority
     if(column == 2)
     {
         auto names = xcb->getXkbNames();
         if(names.size())
-        {
-            int layout2 = (item->data(2, Qt::UserRole).toInt() + 1) % names.size();
-
-            item->setText(2, names.at(layout2));
-            item->setData(2, Qt::UserRole, layout2);
-        }
+            rule->layout = (rule->layout + 1) % names.size();
     }
     // change state
     else
     {
-        auto state2 = item->data(3, Qt::UserRole).toInt();
-        if(state2 >= LayoutState::StateFixed)
-            state2 = LayoutState::StateNormal;
+        if(rule->state >= LayoutState::StateFixed)
+            rule->state = LayoutState::StateNormal;
         else
-            state2 += 1;
-
-        item->setText(3, layoutStateName(state2));
-        item->setData(3, Qt::UserRole, state2);
-
-        setHighlightStatusItem(item, state2);
+            rule->state += 1;
     }
+
+    cacheItemChanged(*rule);
 }
 
-void MainSettings::windowRestoreTitle(xcb_window_t win)
+void MainSettings::windowRestoreTitle(xcb_window_t win, const QStringList & list)
 {
     if(XCB_WINDOW_NONE != win)
     {
-        auto list = xcb->getPropertyStringList(win, XCB_ATOM_WM_CLASS);
-        if(! list.empty() && ! skipClasses.contains(list.front(), Qt::CaseInsensitive))
+        if(! list.empty() && ! skipClasses.match(list))
         {
-            if(auto item = cacheFindItem(list.front(), list.back()))
-            {
-                auto title = item->data(0, Qt::UserRole).toString();
-                xcb->setWindowName(win, title.toStdString());
-            }
+            if(auto rule = cacheFindItem(list.front(), list.back()))
+                xcb->setWindowNameAsync(win, rule->title);
         }
     }
 }
 
 void MainSettings::windowUpdateTitle(xcb_window_t win, const QString & title, const QString & label)
 {
-    auto format = ui->lineEditTitleFormat->text();
-    auto text = format.replace(QString("%{title}"), title).replace(QString("%{label}"), label);
+    auto text = windowTitleFormat(ui->lineEditTitleFormat->text(), title, label);
+
+    // the own PropertyNotify is skipped by the events thread
+    xcb->setWindowNameAsync(win, text);
+}
+
+bool MainSettings::titleRuleUpdate(xcb_window_t win)
+{
+    // memoized: the regex only for the new title
+    int index = titleRules.match(win, xcb->cachedWindowName(win));
+    if(index == titleRuleActive)
+        return 0 <= index;
+
+    titleRuleActive = index;
+    int layout = -1;
+
+    if(0 <= index)
+        layout = titleRules.at(index).layout;
+    else
+    {
+        // title rule left: back to the window layout, then the class rule
+        if(windowsMemory)
+            layout = windowLayouts.find(win);
+
+        if(layout < 0)
+        {
+            if(auto rule = cacheFindItem(prevClasses.front(), prevClasses.back()))
+                layout = rule->layout;
+        }
+    }
+
+    if(0 <= layout && layout != xcb->getXkbLayout() &&
+        layout < xcb->getXkbNames().size())
+        xcb->switchXkbLayoutAsync(layout);
+
+    if(toDebug) {
+        qWarning() << "title rule:" << index << "window:" << win;
+    }
 
-    xcb->setWindowEvents(win, XCB_EVENT_MASK_NO_EVENT);
-    xcb->setWindowName(win, text.toStdString());
-    xcb->setWindowEvents(win, XCB_EVENT_MASK_PROPERTY_CHANGE | XCB_EVENT_MASK_KEY_PRESS);
+    return 0 <= index;
+}
+
+void MainSettings::windowDestroyed(int win)
+{
+    titleRules.remove(win);
+    windowLayouts.remove(win);
 }
 
 void MainSettings::windowTitleChanged(int win)
 {
+    // title rules: the active window only
+    if(static_cast<int>(prevWindow) == win && ! titleRules.isEmpty() &&
+        ! prevClasses.empty() && ! skipClasses.match(prevClasses))
+        titleRuleUpdate(win);
+
     if(ui->checkBoxChangeTitle->isChecked())
     {
-        auto list = xcb->getPropertyStringList(win, XCB_ATOM_WM_CLASS);
+        auto list = xcb->cachedWindowClass(win);
         if(! list.empty())
         {
-            QString title = xcb->getWindowName(win);
+            QString title = xcb->cachedWindowName(win);
             auto layout = xcb->getXkbLayout();
             auto names = xcb->getXkbNames();
 
             // update backup title
-            if(auto item = cacheFindItem(list.front(), list.back()))
-                item->setData(0, Qt::UserRole, title);
+            if(auto rule = cacheFindItem(list.front(), list.back()))
+                rule->title = title;
 
             if(static_cast<int>(prevWindow) == win &&
                 0 <= layout && layout < names.size())
@@ -719,57 +1061,115 @@ void MainSettings::windowTitleChanged(int win)
 
 void MainSettings::activeWindowChanged(int win)
 {
-    // disable events
-    xcb->setWindowEvents(prevWindow, XCB_EVENT_MASK_NO_EVENT);
-
+    // events mask and properties prefetch: from the events thread
     if(ui->checkBoxChangeTitle->isChecked())
-        windowRestoreTitle(prevWindow);
+        windowRestoreTitle(prevWindow, prevClasses);
 
     prevWindow = win;
-
-    // enable events
-    xcb->setWindowEvents(win, XCB_EVENT_MASK_PROPERTY_CHANGE | XCB_EVENT_MASK_KEY_PRESS);
+    prevClasses = xcb->cachedWindowClass(win);
+    titleRuleActive = -1;
 
     // update cache
-    auto list = xcb->getPropertyStringList(win, XCB_ATOM_WM_CLASS);
-    if(list.empty() || skipClasses.contains(list.front(), Qt::CaseInsensitive)) return;
+    auto & list = prevClasses;
+    if(list.empty() || skipClasses.match(list)) return;
+
+    // title rule: precedence over the class rule
+    bool titled = ! titleRules.isEmpty() && titleRuleUpdate(win);
 
     auto layout1 = xcb->getXkbLayout();
     auto names = xcb->getXkbNames();
 
-    if(auto item = cacheFindItem(list.front(), list.back()))
+    // window layout: precedence over the class rule
+    int layout2 = windowsMemory && ! titled ? windowLayouts.find(win) : -1;
+    if(0 <= layout2 && layout2 != layout1 && layout2 < names.size())
+        xcb->switchXkbLayoutAsync(layout2);
+
+    if(auto rule = cacheFindItem(list.front(), list.back()))
     {
         // backup title
-        if(item->data(0, Qt::UserRole).isNull())
+        if(rule->title.isNull())
+            rule->title = xcb->cachedWindowName(win);
+
+        if(! titled && layout2 < 0)
         {
-            QString title = xcb->getWindowName(win);
-            item->setData(0, Qt::UserRole, title);
+            if(rule->layout != layout1)
+                xcb->switchXkbLayoutAsync(rule->layout);
+
+            // new window: from the class rule
+            if(windowsMemory)
+                windowLayouts.insert(win, rule->layout);
         }
 
-        auto layout2 = item->data(2, Qt::UserRole).toInt();
+        // last used: to journal with the hour granularity
+        auto now = QDateTime::currentSecsSinceEpoch();
+        bool journal = rule->lastUsed + 3600 < now;
+        rule->lastUsed = now;
 
-        if(layout2 != layout1)
-            xcb->switchXkbLayout(layout2);
+        if(journal)
+            cacheItemChanged(*rule);
     }
     else
     // item not found
     if(0 <= layout1 && layout1 < names.size())
     {
-        QString title = xcb->getWindowName(win);
-        auto item = new QTreeWidgetItem(QStringList() << list.front() << list.back() << names.at(layout1) << "normal");
+        LayoutRule rule2;
 
-        // title
-        item->setData(0, Qt::UserRole, title);
-        // layout
-        item->setData(2, Qt::UserRole, layout1);
-        // state
-        item->setData(3, Qt::UserRole, int(LayoutState::StateNormal));
-        ui->treeWidgetCache->addTopLevelItem(item);
+        rule2.class1 = list.front();
+        rule2.class2 = list.back();
+        rule2.title = xcb->cachedWindowName(win);
+        rule2.layout = layout1;
+        rule2.state = LayoutState::StateNormal;
+        rule2.lastUsed = QDateTime::currentSecsSinceEpoch();
+
+        cacheItemChanged(cacheRules.insert(rule2), true);
+
+        if(windowsMemory && ! titled)
+            windowLayouts.insert(win, layout1);
     }
 
     windowTitleChanged(win);
 }
 
+void MainSettings::hotkeyPressed(int id)
+{
+    if(id < 0 || id >= hotkeyRules.size())
+        return;
+
+    auto & hotkey = hotkeyRules.at(id);
+
+    if(hotkey.action == HotkeyAction::HotkeyLayout)
+    {
+        if(hotkey.layout < xcb->getXkbNames().size())
+            xcb->switchXkbLayoutAsync(hotkey.layout);
+    }
+    else
+    if(hotkey.action == HotkeyAction::HotkeyCycle)
+    {
+        xcb->switchXkbLayoutAsync();
+    }
+    else
+    if(hotkey.action == HotkeyAction::HotkeyState)
+    {
+        auto & list = prevClasses;
+        if(list.empty())
+            return;
+
+        if(auto rule = cacheFindItem(list.front(), list.back()))
+        {
+            if(rule->state >= LayoutState::StateFixed)
+                rule->state = LayoutState::StateNormal;
+            else
+                rule->state += 1;
+
+            if(toDebug) {
+                qWarning() << "hotkey state:" << rule->class1 << layoutStateName(rule->state);
+            }
+
+            cacheItemChanged(*rule);
+        }
+    }
+}
+
 void MainSettings::xkbNewKeyboardChanged(int changed)
 {
     // XCB_XKB_NKN_DETAIL_KEYCODES = 1, XCB_XKB_NKN_DETAIL_GEOMETRY = 2, XCB_XKB_NKN_DETAIL_DEVICE_ID = 4
@@ -778,7 +1178,10 @@ void MainSettings::xkbNewKeyboardChanged(int changed)
         return;
 
     if(changed & XCB_XKB_NKN_DETAIL_GEOMETRY)
+    {
         forceReload = true;
+        xkbRulesCheck();
+    }
 }
 
 void MainSettings::xkbStateChanged(int layout1)
@@ -786,36 +1189,50 @@ void MainSettings::xkbStateChanged(int layout1)
     if(0 == prevWindow)
         return;
 
-    auto list = xcb->getPropertyStringList(prevWindow, XCB_ATOM_WM_CLASS);
-    if(list.empty() || skipClasses.contains(list.front(), Qt::CaseInsensitive)) return;
+    auto & list = prevClasses;
+    if(list.empty() || skipClasses.match(list)) return;
 
     auto names = xcb->getXkbNames();
-    auto item = cacheFindItem(list.front(), list.back());
 
-    if(item)
+    // title rule: the index resolved on the title change, the class rule untouched
+    if(0 <= titleRuleActive)
+    {
+        auto & trule = titleRules.at(titleRuleActive);
+        // out of range: the server wraps the group, without revert loop
+        if(trule.state == LayoutState::StateFixed && trule.layout != layout1 &&
+            trule.layout < names.size())
+            xcb->switchXkbLayoutAsync(trule.layout);
+    }
+    else
+    // window layout, the class rule updated also: for the new windows
+    if(windowsMemory && 0 <= layout1 && layout1 < names.size())
+    {
+        windowLayouts.insert(prevWindow, layout1);
+    }
+
+    if(auto rule = cacheFindItem(list.front(), list.back()))
     {
-        auto state2 = item->data(3, Qt::UserRole).toInt();
-        auto layout2 = item->data(2, Qt::UserRole).toInt();
         bool play = false;
+        bool changed = false;
 
-        if(layout2 != layout1)
+        if(titleRuleActive < 0 && rule->layout != layout1)
         {
-            if(state2 == LayoutState::StateFixed)
+            if(rule->state == LayoutState::StateFixed)
             {
                 // revert layout
-                xcb->switchXkbLayout(layout2);
+                xcb->switchXkbLayoutAsync(rule->layout);
             }
             else
-            if(state2 == LayoutState::StateNormal &&
+            if(rule->state == LayoutState::StateNormal &&
                 0 <= layout1 && layout1 < names.size())
             {
-                item->setText(2, names.at(layout1));
-                item->setData(2, Qt::UserRole, layout1);
+                rule->layout = layout1;
+                changed = true;
                 play = true;
             }
         }
 
-        if(state2 == LayoutState::StateFirst)
+        if(rule->state == LayoutState::StateFirst)
             play = true;
 
         if(play && ui->checkBoxSound->isChecked())
@@ -832,21 +1249,28 @@ void MainSettings::xkbStateChanged(int layout1)
         if(ui->checkBoxChangeTitle->isChecked() &&
             0 <= layout1 && layout1 < names.size())
         {
-            auto title = item->data(0, Qt::UserRole).toString();
-            windowUpdateTitle(prevWindow, title, names.at(layout1));
+            windowUpdateTitle(prevWindow, rule->title, names.at(layout1));
         }
+
+        // the last: the rule reference invalid after
+        if(changed)
+            cacheItemChanged(*rule);
     }
     else
     if(0 <= layout1 && layout1 < names.size())
     {
-        auto item = new QTreeWidgetItem(QStringList() << list.front() << list.back() << names.at(layout1) << "normal");
-        item->setData(2, Qt::UserRole, layout1);
-        item->setData(3, Qt::UserRole, int(LayoutState::StateNormal));
-        ui->treeWidgetCache->addTopLevelItem(item);
+        LayoutRule rule2;
+
+        rule2.class1 = list.front();
+        rule2.class2 = list.back();
+        rule2.layout = layout1;
+        rule2.state = LayoutState::StateNormal;
+        rule2.lastUsed = QDateTime::currentSecsSinceEpoch();
+
+        cacheItemChanged(cacheRules.insert(rule2), true);
     }
 
-    if(layout1 < layoutIcons.size())
-        trayIcon->setIcon(layoutIcons.at(layout1));
+    trayIconUpdate(layout1);
 }
 
 QPixmap MainSettings::getLayoutIcon(const QString & layoutName)
@@ -863,27 +1287,17 @@ QPixmap MainSettings::getLayoutIcon(const QString & layoutName)
                 return px;
         }
 
+        // decoded from the mapped pack, only used icons
+        if(iconPack.isOpen() &&
+            px.loadFromData(iconPack.find(layoutName.left(2).toLower()), "PNG"))
+            return px;
+
         if(px.load(QString(":/icons/").append(layoutName.left(2).toLower())))
             return px;
     }
 
-    QImage image(32, 32, QImage::Format_RGBA8888);
-    auto backcol = ui->lineEditBackgroundColor->text();
-    image.fill(backcol == "transparent" ? Qt::transparent : QColor(backcol));
-
-    QPainter painter(&image);
-    painter.setPen(QColor(ui->lineEditTextColor->text()));
-
-    // fontName, fontSize, fontWeight
-    auto fontArgs = ui->lineEditFont->text().split(", ");
-    QFont font(fontArgs.front());
-    if(1 < fontArgs.size())
-        font.setPointSize(fontArgs.at(1).toInt());
-    if(2 < fontArgs.size())
-        font.setWeight((QFont::Weight) fontArgs.at(2).toInt());
-
-    painter.setFont(font);
-    painter.drawText(image.rect(), Qt::AlignCenter, layoutName.left(2));
+    auto image = layoutLabelImage(layoutName.left(2), ui->lineEditFont->text(),
+                    ui->lineEditBackgroundColor->text(), ui->lineEditTextColor->text(), qApp->devicePixelRatio());
 
     return QPixmap::fromImage(image);
 }
@@ -893,14 +1307,76 @@ void MainSettings::initXkbLayoutIcons(void)
     ui->systemInfo->setText(QString("xkb info: %1").arg(xcb->getSymbolsLabel()));
     layoutIcons.clear();
 
+    // all icon attributes in key
+    auto attrs = QString("%1|%2|%3|%4|%5|%6|%7").
+        arg((int) ui->groupBoxPictureMode->isChecked()).
+        arg((int) ui->fromIconsPath->isChecked()).
+        arg(ui->lineEditIconsPath->text()).
+        arg(ui->lineEditBackgroundColor->text()).
+        arg(ui->lineEditTextColor->text()).
+        arg(ui->lineEditFont->text()).
+        arg(qApp->devicePixelRatio());
+
     for(auto & name : xcb->getXkbNames())
-        layoutIcons << getLayoutIcon(name);
-}
+    {
+        auto key = QString("%1|%2").arg(name.left(2), attrs);
+        auto it = layoutIconsCache.find(key);
 
-/* XcbConnection */
-XcbConnection::XcbConnection(bool debug) :
+        if(it == layoutIconsCache.end())
+        {
+            // a few attributes and layouts
+            if(64 < layoutIconsCache.size())
+                layoutIconsCache.clear();
+
+            it = layoutIconsCache.insert(key, QIcon(getLayoutIcon(name)));
+        }
+
+        layoutIcons << it.value();
+    }
+}
+
+void MainSettings::trayIconUpdate(int index)
+{
+    if(0 > index || index >= layoutIcons.size())
+        return;
+
+    auto & icon = layoutIcons.at(index);
+
+    // the same icon: not sent to the tray host
+    if(icon.cacheKey() != trayIconKey)
+    {
+        trayIcon->setIcon(icon);
+        trayIconKey = icon.cacheKey();
+    }
+}
+
+/* XcbConnection */
+QStringList propertyStringList(const xcb_get_property_reply_t* reply)
+{
+    QStringList res;
+
+    if(reply)
+    {
+        int len = xcb_get_property_value_length(reply);
+        auto ptr = static_cast<const char*>(xcb_get_property_value(reply));
+
+        res = windowStringList(ptr, len);
+    }
+
+    return res;
+}
+
+QString propertyWindowName(const xcb_get_property_reply_t* reply, xcb_atom_t utf8String)
+{
+    if(reply && (reply->type == XCB_ATOM_STRING || reply->type == utf8String))
+        return QString::fromUtf8(static_cast<const char*>(xcb_get_property_value(reply)), xcb_get_property_value_length(reply));
+
+    return nullptr;
+}
+
+XcbConnection::XcbConnection(bool debug) :
     conn{ xcb_connect(nullptr, nullptr), xcb_disconnect },
-    xkbctx{ nullptr, xkb_context_unref }, xkbmap{ nullptr, xkb_keymap_unref }, xkbstate{ nullptr, xkb_state_unref },
+    xkbmap{ nullptr, xkb_keymap_unref }, xkbstate{ nullptr, xkb_state_unref },
     xkbext(nullptr), root(XCB_WINDOW_NONE), xkbdevid(-1), atomActiveWindow(XCB_ATOM_NONE), atomNetWmName(XCB_ATOM_NONE), atomUtf8String(XCB_ATOM_NONE),
     toDebug(debug)
 {
@@ -916,9 +1392,15 @@ XcbConnection::XcbConnection(bool debug) :
         throw std::runtime_error("xcb_setup_roots");
 
     root = screen->root;
-    atomActiveWindow = getAtom("_NET_ACTIVE_WINDOW");
-    atomNetWmName = getAtom("_NET_WM_NAME");
-    atomUtf8String = getAtom("UTF8_STRING");
+
+    // intern all known atoms with one pipelined batch
+    auto atoms = getAtoms(QStringList() << "_NET_ACTIVE_WINDOW" << "_NET_WM_NAME" << "UTF8_STRING" << "_XKB_RULES_NAMES" << "WM_STATE");
+
+    atomActiveWindow = atoms.at(0);
+    atomNetWmName = atoms.at(1);
+    atomUtf8String = atoms.at(2);
+    atomXkbRulesNames = atoms.at(3);
+    atomWmState = atoms.at(4);
 
     xkbext = xcb_get_extension_data(conn.get(), &xcb_xkb_id);
     if(! xkbext)
@@ -933,275 +1415,1353 @@ XcbConnection::XcbConnection(bool debug) :
     if(xkbdevid < 0)
         throw std::runtime_error("xkb_x11_get_core_keyboard_device_id");
 
-    xkbctx.reset(xkb_context_new(XKB_CONTEXT_NO_FLAGS));
-    if(! xkbctx)
-        throw std::runtime_error("xkb_context_new");
-
-    xkbmap.reset(xkb_x11_keymap_new_from_device(xkbctx.get(), conn.get(), xkbdevid, XKB_KEYMAP_COMPILE_NO_FLAGS));
-    if(!xkbmap)
-        throw std::runtime_error("xkb_x11_keymap_new_from_device");
-
-    xkbstate.reset(xkb_x11_state_new_from_device(xkbmap.get(), conn.get(), xkbdevid));
-    if(!xkbstate)
-        throw std::runtime_error("xkb_x11_state_new_from_device");
+    // keymap and state: loaded from the events thread, see XcbEventsPool::keymapRebuild
 
     // XCB_XKB_MAP_PART_KEY_TYPES, XCB_XKB_MAP_PART_KEY_SYMS, XCB_XKB_MAP_PART_MODIFIER_MAP, XCB_XKB_MAP_PART_EXPLICIT_COMPONENTS
     // XCB_XKB_MAP_PART_KEY_ACTIONS, XCB_XKB_MAP_PART_VIRTUAL_MODS, XCB_XKB_MAP_PART_VIRTUAL_MOD_MAP
     uint16_t required_map_parts = 0;
-    uint16_t required_events = XCB_XKB_EVENT_TYPE_NEW_KEYBOARD_NOTIFY | XCB_XKB_EVENT_TYPE_MAP_NOTIFY | XCB_XKB_EVENT_TYPE_STATE_NOTIFY;
+    uint16_t required_events = XCB_XKB_EVENT_TYPE_NEW_KEYBOARD_NOTIFY | XCB_XKB_EVENT_TYPE_MAP_NOTIFY |
+                                XCB_XKB_EVENT_TYPE_STATE_NOTIFY | XCB_XKB_EVENT_TYPE_NAMES_NOTIFY;
 
     auto cookie = xcb_xkb_select_events_checked(conn.get(), xkbdevid, required_events, 0, required_events, required_map_parts, required_map_parts, nullptr);
     if(GenericError(xcb_request_check(conn.get(), cookie)))
         throw std::runtime_error("xcb_xkb_select_events");
 
-    const uint32_t values[] = { XCB_EVENT_MASK_PROPERTY_CHANGE };
-    xcb_change_window_attributes(conn.get(), root, XCB_CW_EVENT_MASK, values);
+    const uint32_t values[] = { XCB_EVENT_MASK_PROPERTY_CHANGE };
+    xcb_change_window_attributes(conn.get(), root, XCB_CW_EVENT_MASK, values);
+
+    // init xkb mirror, after select events
+    auto stateReply = getReplyFunc2(xcb_xkb_get_state, conn.get(), XCB_XKB_ID_USE_CORE_KBD);
+
+    if(stateReply.error())
+        throw std::runtime_error("xcb_xkb_get_state");
+
+    if(auto & reply = stateReply.reply())
+        xkbGroup = reply->group;
+
+    if(! loadXkbNames())
+        throw std::runtime_error("xcb_xkb_get_names");
+
+    loadXkbRulesNames();
+}
+
+QString XcbConnection::getAtomName(xcb_atom_t atom) const
+{
+    return getAtomNames(QList<xcb_atom_t>() << atom).front();
+}
+
+QStringList XcbConnection::getAtomNames(const QList<xcb_atom_t> & atoms) const
+{
+    QStringList res;
+    std::vector<std::pair<int, xcb_get_atom_name_cookie_t>> cookies;
+
+    {
+        const std::lock_guard<std::mutex> lock(atomsLock);
+
+        for(auto & atom : atoms)
+        {
+            auto it = atomsById.find(atom);
+
+            if(it != atomsById.end())
+            {
+                res << it.value();
+                continue;
+            }
+
+            res << QString("NONE");
+
+            if(atom != XCB_ATOM_NONE)
+                cookies.emplace_back(res.size() - 1, xcb_get_atom_name(conn.get(), atom));
+        }
+    }
+
+    // send all, then wait replies
+    for(auto & [index, cookie] : cookies)
+    {
+        auto xcbReply = getReply2<xcb_get_atom_name_reply_t, xcb_get_atom_name_cookie_t>(xcb_get_atom_name_reply, cookie);
+
+        if(auto & reply = xcbReply.reply())
+        {
+            const char* name = xcb_get_atom_name_name(reply.get());
+            size_t len = xcb_get_atom_name_name_length(reply.get());
+            res[index] = QString(QByteArray(name, len));
+
+            const std::lock_guard<std::mutex> lock(atomsLock);
+            atomsById.insert(atoms.at(index), res.at(index));
+            atomsByName.insert(res.at(index), atoms.at(index));
+        }
+    }
+
+    return res;
+}
+
+xcb_atom_t XcbConnection::getAtom(const QString & name, bool create) const
+{
+    return getAtoms(QStringList() << name, create).front();
+}
+
+QList<xcb_atom_t> XcbConnection::getAtoms(const QStringList & names, bool create) const
+{
+    QList<xcb_atom_t> res;
+    std::vector<std::pair<int, xcb_intern_atom_cookie_t>> cookies;
+
+    {
+        const std::lock_guard<std::mutex> lock(atomsLock);
+
+        for(auto & name : names)
+        {
+            auto it = atomsByName.find(name);
+
+            if(it != atomsByName.end())
+            {
+                res << it.value();
+                continue;
+            }
+
+            auto str = name.toUtf8();
+            res << XCB_ATOM_NONE;
+            cookies.emplace_back(res.size() - 1, xcb_intern_atom(conn.get(), create ? 0 : 1, str.size(), str.constData()));
+        }
+    }
+
+    // send all, then wait replies
+    for(auto & [index, cookie] : cookies)
+    {
+        auto xcbReply = getReply2<xcb_intern_atom_reply_t, xcb_intern_atom_cookie_t>(xcb_intern_atom_reply, cookie);
+
+        if(auto & reply = xcbReply.reply())
+        {
+            res[index] = reply->atom;
+
+            // not exists: not cached, can be created later
+            if(reply->atom != XCB_ATOM_NONE)
+            {
+                const std::lock_guard<std::mutex> lock(atomsLock);
+                atomsByName.insert(names.at(index), reply->atom);
+                atomsById.insert(reply->atom, names.at(index));
+            }
+        }
+    }
+
+    return res;
+}
+
+xcb_window_t XcbConnection::getActiveWindow(void) const
+{
+    return getPropertyWindow(root, atomActiveWindow);
+}
+
+QString XcbConnection::getSymbolsLabel(void) const
+{
+    const std::lock_guard<std::mutex> lock(xkbNamesLock);
+    return xkbSymbolsLabel;
+}
+
+QStringList XcbConnection::getXkbNames(void) const
+{
+    const std::lock_guard<std::mutex> lock(xkbNamesLock);
+    return xkbGroupNames;
+}
+
+QStringList XcbConnection::getXkbRulesNames(void) const
+{
+    const std::lock_guard<std::mutex> lock(xkbNamesLock);
+    return xkbRulesNames;
+}
+
+void XcbConnection::loadXkbRulesNames(void)
+{
+    // rules, model, layout, variant, options
+    auto names = propertyStringList(getPropertyAnyType(root, atomXkbRulesNames, 0, 1024).get());
+
+    const std::lock_guard<std::mutex> lock(xkbNamesLock);
+    xkbRulesNames.swap(names);
+}
+
+bool XcbConnection::loadXkbNames(void)
+{
+    auto xcbReply = getReplyFunc2(xcb_xkb_get_names, conn.get(), XCB_XKB_ID_USE_CORE_KBD, XCB_XKB_NAME_DETAIL_GROUP_NAMES | XCB_XKB_NAME_DETAIL_SYMBOLS);
+
+    if(auto & err = xcbReply.error())
+    {
+        qWarning() << err.toString("xcb_xkb_get_names");
+        return false;
+    }
+
+    QStringList names;
+    QString symbols;
+
+    if(auto & reply = xcbReply.reply())
+    {
+        const void *buffer = xcb_xkb_get_names_value_list(reply.get());
+        xcb_xkb_get_names_value_list_t list;
+
+        xcb_xkb_get_names_value_list_unpack(buffer, reply->nTypes, reply->indicators, reply->virtualMods,
+                                            reply->groupNames, reply->nKeys, reply->nKeyAliases, reply->nRadioGroups, reply->which, & list);
+        int groups = xcb_xkb_get_names_value_list_groups_length(reply.get(), & list);
+        QList<xcb_atom_t> atoms;
+
+        for(int ii = 0; ii < groups; ++ii)
+            atoms << list.groups[ii];
+
+        // resolve all names with one batch, symbols last
+        names = getAtomNames(atoms << list.symbolsName);
+        symbols = names.takeLast();
+    }
+
+    const std::lock_guard<std::mutex> lock(xkbNamesLock);
+    xkbGroupNames.swap(names);
+    xkbSymbolsLabel.swap(symbols);
+
+    return true;
+}
+
+void XcbConnection::switchXkbLayout(int layout)
+{
+    // next
+    if(layout < 0)
+    {
+        auto names = getXkbNames();
+        if(names.isEmpty())
+            return;
+
+        layout = (getXkbLayout() + 1) % names.size();
+    }
+
+    auto cookie = xcb_xkb_latch_lock_state(conn.get(), XCB_XKB_ID_USE_CORE_KBD, 0, 0, 1, layout, 0, 0, 0);
+    requestSent(cookie.sequence, "xcb_xkb_latch_lock_state");
+}
+
+int XcbConnection::getDeviceId(void) const
+{
+    return xkbdevid;
+}
+
+int XcbConnection::getXkbLayout(void) const
+{
+    return xkbGroup;
+}
+
+XcbPropertyCookie XcbConnection::sendGetProperty(xcb_window_t win, xcb_atom_t prop, xcb_atom_t type, uint32_t offset, uint32_t length) const
+{
+    return sendRequestFunc2(xcb_get_property, conn.get(), false, win, prop, type, offset, length);
+}
+
+XcbPropertyReply XcbConnection::getProperty(const XcbPropertyCookie & cookie) const
+{
+    auto xcbReply = getReply2(cookie);
+
+    if(auto & err = xcbReply.error()) {
+        if(toDebug) {
+            qWarning() << err.toString("xcb_get_property");
+        }
+    }
+
+    return XcbPropertyReply(std::move(xcbReply.first));
+}
+
+XcbPropertyReply XcbConnection::getPropertyAnyType(xcb_window_t win, xcb_atom_t prop, uint32_t offset, uint32_t length) const
+{
+    return getProperty(sendGetProperty(win, prop, XCB_GET_PROPERTY_TYPE_ANY, offset, length));
+}
+
+xcb_atom_t XcbConnection::getPropertyType(xcb_window_t win, xcb_atom_t prop) const
+{
+    uint32_t generation = 0;
+
+    {
+        const std::lock_guard<std::mutex> lock(windowsLock);
+        auto it = windowsCache.find(win);
+
+        if(it != windowsCache.end() && it->types.contains(prop))
+            return it->types.value(prop);
+
+        generation = windowsGeneration;
+    }
+
+    auto reply = getPropertyAnyType(win, prop, 0, 0);
+    if(! reply)
+        return XCB_ATOM_NONE;
+
+    const std::lock_guard<std::mutex> lock(windowsLock);
+    if(generation == windowsGeneration)
+        windowsCache[win].types.insert(prop, reply->type);
+
+    return reply->type;
+}
+
+QString XcbConnection::getWindowName(xcb_window_t win) const
+{
+    uint32_t generation = 0;
+
+    {
+        const std::lock_guard<std::mutex> lock(windowsLock);
+        auto it = windowsCache.find(win);
+
+        if(it != windowsCache.end() && it->hasName)
+            return it->name;
+
+        generation = windowsGeneration;
+    }
+
+    QString res;
+
+    // type and value with one request, WM_NAME fallback
+    for(xcb_atom_t prop : { atomNetWmName, (xcb_atom_t) XCB_ATOM_WM_NAME })
+    {
+        res = propertyWindowName(getPropertyAnyType(win, prop, 0, 8192).get(), atomUtf8String);
+
+        if(! res.isEmpty())
+            break;
+    }
+
+    const std::lock_guard<std::mutex> lock(windowsLock);
+    if(generation == windowsGeneration)
+    {
+        auto & cache = windowsCache[win];
+        cache.name = res;
+        cache.hasName = true;
+    }
+
+    return res;
+}
+
+void XcbConnection::prefetchWindow(xcb_window_t win) const
+{
+    uint32_t generation = 0;
+    bool needClass = true;
+    bool needName = true;
+
+    {
+        const std::lock_guard<std::mutex> lock(windowsLock);
+        auto it = windowsCache.find(win);
+
+        if(it != windowsCache.end())
+        {
+            needClass = ! it->hasClass;
+            needName = ! it->hasName;
+        }
+
+        generation = windowsGeneration;
+    }
+
+    if(! needClass && ! needName)
+        return;
+
+    // send all requests, then wait replies: one round trip
+    XcbPropertyCookie classCookie{}, netNameCookie{}, wmNameCookie{};
+
+    if(needClass)
+        classCookie = sendGetProperty(win, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 0, ~0);
+
+    if(needName)
+    {
+        netNameCookie = sendGetProperty(win, atomNetWmName, XCB_GET_PROPERTY_TYPE_ANY, 0, 8192);
+        wmNameCookie = sendGetProperty(win, XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, 8192);
+    }
+
+    xcb_flush(conn.get());
+
+    QStringList wmClass;
+    QString name;
+
+    if(needClass)
+        wmClass = propertyStringList(getProperty(classCookie).get());
+
+    if(needName)
+    {
+        // always take both replies
+        auto netName = getProperty(netNameCookie);
+        auto wmName = getProperty(wmNameCookie);
+
+        name = propertyWindowName(netName.get(), atomUtf8String);
+        if(name.isEmpty())
+            name = propertyWindowName(wmName.get(), atomUtf8String);
+    }
+
+    const std::lock_guard<std::mutex> lock(windowsLock);
+    if(generation == windowsGeneration)
+    {
+        auto & cache = windowsCache[win];
+
+        if(needClass)
+        {
+            cache.wmClass = wmClass;
+            cache.hasClass = true;
+        }
+
+        if(needName)
+        {
+            cache.name = name;
+            cache.hasName = true;
+        }
+    }
+}
+
+void XcbConnection::windowCacheInvalidate(xcb_window_t win, xcb_atom_t prop)
+{
+    const std::lock_guard<std::mutex> lock(windowsLock);
+    windowsGeneration++;
+
+    auto it = windowsCache.find(win);
+    if(it == windowsCache.end())
+        return;
+
+    it->types.remove(prop);
+
+    if(prop == XCB_ATOM_WM_CLASS)
+    {
+        it->wmClass.clear();
+        it->hasClass = false;
+    }
+    else
+    if(prop == atomNetWmName || prop == XCB_ATOM_WM_NAME)
+    {
+        it->name.clear();
+        it->hasName = false;
+    }
+}
+
+void XcbConnection::windowCacheRemove(xcb_window_t win)
+{
+    const std::lock_guard<std::mutex> lock(windowsLock);
+    windowsGeneration++;
+    windowsCache.remove(win);
+}
+
+void XcbConnection::windowCacheSetName(xcb_window_t win, const QString & name)
+{
+    const std::lock_guard<std::mutex> lock(windowsLock);
+    windowsGeneration++;
+
+    auto it = windowsCache.find(win);
+    // invalidated: the client title refetched, not replaced with the own
+    if(it == windowsCache.end() || ! it->hasName)
+        return;
+
+    it->name = name;
+    it->hasName = true;
+    it->types.insert(atomNetWmName, atomUtf8String);
+}
+
+QStringList XcbConnection::cachedWindowClass(xcb_window_t win) const
+{
+    const std::lock_guard<std::mutex> lock(windowsLock);
+    auto it = windowsCache.find(win);
+
+    return it != windowsCache.end() ? it->wmClass : QStringList();
+}
+
+QString XcbConnection::cachedWindowName(xcb_window_t win) const
+{
+    const std::lock_guard<std::mutex> lock(windowsLock);
+    auto it = windowsCache.find(win);
+
+    return it != windowsCache.end() ? it->name : QString();
+}
+
+void XcbConnection::setWindowEvents(xcb_window_t win, uint32_t mask)
+{
+    // property changes not tracked, drop cache
+    if(0 == (mask & XCB_EVENT_MASK_PROPERTY_CHANGE))
+        windowCacheRemove(win);
+
+    const uint32_t values[] = { mask };
+    auto cookie = xcb_change_window_attributes(conn.get(), win, XCB_CW_EVENT_MASK, values);
+    requestSent(cookie.sequence, "xcb_change_window_attributes");
+}
+
+GenericError XcbConnection::checkRequest(const xcb_void_cookie_t & cookie) const
+{
+    auto err = GenericError(xcb_request_check(conn.get(), cookie));
+    eventsQueued();
+    return err;
+}
+
+void XcbConnection::setWindowName(xcb_window_t win, const std::string & title)
+{
+    // set wm name
+    auto cookie = xcb_change_property(conn.get(), XCB_PROP_MODE_REPLACE, win, atomNetWmName, atomUtf8String, 8, title.size(), title.data());
+    requestSent(cookie.sequence, "xcb_change_property");
+
+    // the value is known, the notify will be skipped; the next writes before notify queued
+    ownTitleWrites.push_back(XcbTitleWrite{ win, cookie.sequence });
+
+    // without events for long: the oldest not waited
+    if(256 < ownTitleWrites.size())
+        ownTitleWrites.pop_front();
+
+    windowCacheSetName(win, QString::fromStdString(title));
+}
+
+XcbHotkey XcbHotkey::parse(const QString & str)
+{
+    XcbHotkey res;
+    auto list = str.split('+');
+
+    for(auto & val : list)
+    {
+        auto name = val.trimmed();
+
+        // the last: keysym name
+        if(& val == & list.back())
+        {
+            res.keysym = xkb_keysym_from_name(name.toUtf8().constData(), XKB_KEYSYM_CASE_INSENSITIVE);
+            break;
+        }
+
+        name = name.toLower();
+
+        if(name == "ctrl" || name == "control")
+            res.mods |= XCB_MOD_MASK_CONTROL;
+        else
+        if(name == "shift")
+            res.mods |= XCB_MOD_MASK_SHIFT;
+        else
+        if(name == "alt" || name == "mod1")
+            res.mods |= XCB_MOD_MASK_1;
+        else
+        if(name == "mod3")
+            res.mods |= XCB_MOD_MASK_3;
+        else
+        if(name == "super" || name == "win" || name == "mod4")
+            res.mods |= XCB_MOD_MASK_4;
+        else
+        if(name == "altgr" || name == "mod5")
+            res.mods |= XCB_MOD_MASK_5;
+        else
+        {
+            res.keysym = XKB_KEY_NoSymbol;
+            break;
+        }
+    }
+
+    return res;
+}
+
+// CapsLock and NumLock not changed the hotkey
+static const uint16_t hotkeyIgnoredMods[] = { 0, XCB_MOD_MASK_LOCK, XCB_MOD_MASK_2, XCB_MOD_MASK_LOCK | XCB_MOD_MASK_2 };
+
+void XcbConnection::grabHotkeys(void)
+{
+    for(auto & grab : keyGrabs)
+    {
+        for(auto mask : hotkeyIgnoredMods)
+        {
+            auto cookie = xcb_ungrab_key(conn.get(), grab.keycode, root, grab.mods | mask);
+            requestSent(cookie.sequence, "xcb_ungrab_key");
+        }
+    }
+
+    keyGrabs.clear();
+
+    // the keymap is loading: grabbed after install
+    if(hotkeys.empty() || ! xkbmap)
+        return;
+
+    auto map = xkbmap.get();
+    auto maxKey = std::min<xkb_keycode_t>(xkb_keymap_max_keycode(map), 255);
+
+    for(xkb_keycode_t key = xkb_keymap_min_keycode(map); key <= maxKey; ++key)
+    {
+        for(xkb_layout_index_t layout = 0; layout < xkb_keymap_num_layouts_for_key(map, key); ++layout)
+        {
+            for(xkb_level_index_t level = 0; level < xkb_keymap_num_levels_for_key(map, key, layout); ++level)
+            {
+                const xkb_keysym_t* syms = nullptr;
+                int count = xkb_keymap_key_get_syms_by_level(map, key, layout, level, & syms);
+
+                for(int id = 0; id < (int) hotkeys.size(); ++id)
+                {
+                    auto & hotkey = hotkeys[id];
+
+                    if(std::none_of(syms, syms + count, [&](auto & sym){ return sym == hotkey.keysym; }))
+                        continue;
+
+                    if(std::any_of(keyGrabs.begin(), keyGrabs.end(), [&](auto & grab){ return grab.keycode == key && grab.mods == hotkey.mods; }))
+                        continue;
+
+                    keyGrabs.push_back(XcbKeyGrab{ static_cast<xcb_keycode_t>(key), hotkey.mods, id });
+                }
+            }
+        }
+    }
+
+    for(auto & grab : keyGrabs)
+    {
+        for(auto mask : hotkeyIgnoredMods)
+        {
+            auto cookie = xcb_grab_key(conn.get(), 1, root, grab.mods | mask, grab.keycode, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+            requestSent(cookie.sequence, "xcb_grab_key");
+        }
+    }
+
+    if(toDebug) {
+        qWarning() << "hotkeys:" << hotkeys.size() << "grabs:" << keyGrabs.size();
+    }
+}
+
+int XcbConnection::findHotkey(xcb_keycode_t keycode, uint16_t state) const
+{
+    // core mods only, without group and locks
+    uint16_t mods = state & 0xFF & ~(XCB_MOD_MASK_LOCK | XCB_MOD_MASK_2);
+
+    for(auto & grab : keyGrabs)
+        if(grab.keycode == keycode && grab.mods == mods)
+            return grab.id;
+
+    return -1;
+}
+
+bool XcbConnection::ownTitleNotify(xcb_window_t win, uint16_t sequence)
+{
+    // expired: the writes left are this sequence or newer
+    auto it = std::find_if(ownTitleWrites.begin(), ownTitleWrites.end(), [&](const XcbTitleWrite & write)
+    {
+        return write.win == win;
+    });
+
+    if(it == ownTitleWrites.end())
+        return false;
+
+    // the first notify with this sequence is ours, the next are from other clients
+    if(static_cast<uint16_t>(it->sequence) == sequence)
+        ownTitleWrites.erase(it);
+
+    // other client before the own write: the value is own
+    return true;
+}
+
+void XcbConnection::ownTitleExpire(uint16_t sequence)
+{
+    // the events in order: the writes before this sequence processed, their notify delivered
+    while(! ownTitleWrites.empty() &&
+        0 < static_cast<int16_t>(sequence - static_cast<uint16_t>(ownTitleWrites.front().sequence)))
+        ownTitleWrites.pop_front();
+}
+
+void XcbConnection::requestSent(uint32_t sequence, const char* name)
+{
+    sentRequests[sentRequestsPos] = XcbSentRequest{ sequence, name };
+    sentRequestsPos = (sentRequestsPos + 1) % sentRequests.size();
+}
+
+void XcbConnection::requestError(const xcb_generic_error_t* err) const
+{
+    const char* name = nullptr;
+
+    // the error has the low 16 bits of sequence, find the last sent
+    for(size_t it = 0; it < sentRequests.size(); ++it)
+    {
+        auto & req = sentRequests[(sentRequestsPos + sentRequests.size() - 1 - it) % sentRequests.size()];
+
+        if(req.name && (req.sequence & 0xFFFF) == err->sequence)
+        {
+            name = req.name;
+            break;
+        }
+    }
+
+    if(toDebug) {
+        qWarning() << QString("%1 error code: %2, major: 0x%3, minor: 0x%4, sequence: %5, resource: 0x%6").
+            arg(QString(name ? name : "unknown request")).
+            arg((int) err->error_code).
+            arg(err->major_code, 2, 16, QChar('0')).
+            arg(err->minor_code, 4, 16, QChar('0')).
+            arg((uint) err->sequence).
+            arg(err->resource_id, 8, 16, QChar('0'));
+    }
+}
+
+QString XcbConnection::getPropertyString(xcb_window_t win, xcb_atom_t prop) const
+{
+    if(XCB_ATOM_STRING == getPropertyType(win, prop))
+    {
+        if(auto reply = getPropertyAnyType(win, prop, 0, 8192))
+        {
+            auto ptr = reinterpret_cast<const char*>(reply.value());
+            if(ptr) return QString(ptr);
+        }
+    }
+
+    return nullptr;
+}
+
+xcb_window_t XcbConnection::getPropertyWindow(xcb_window_t win, xcb_atom_t prop, uint32_t offset) const
+{
+    auto xcbReply = getReplyFunc2(xcb_get_property, conn.get(), false, win, prop, XCB_ATOM_WINDOW, offset, 1);
+
+    if(xcbReply.error())
+        return XCB_WINDOW_NONE;
+
+    if(auto & reply = xcbReply.reply())
+    {
+        if(auto res = static_cast<xcb_window_t*>(xcb_get_property_value(reply.get())))
+            return *res;
+    }
+
+    return XCB_WINDOW_NONE;
+}
+
+QStringList XcbConnection::getPropertyStringList(xcb_window_t win, xcb_atom_t prop) const
+{
+    uint32_t generation = 0;
+
+    if(prop == XCB_ATOM_WM_CLASS)
+    {
+        const std::lock_guard<std::mutex> lock(windowsLock);
+        auto it = windowsCache.find(win);
+
+        if(it != windowsCache.end() && it->hasClass)
+            return it->wmClass;
+
+        generation = windowsGeneration;
+    }
+
+    auto xcbReply = getReplyFunc2(xcb_get_property, conn.get(), false, win, prop, XCB_ATOM_STRING, 0, ~0);
+
+    if(xcbReply.error())
+        return QStringList();
+
+    auto res = propertyStringList(xcbReply.reply().get());
+
+    if(prop == XCB_ATOM_WM_CLASS)
+    {
+        const std::lock_guard<std::mutex> lock(windowsLock);
+        if(generation == windowsGeneration)
+        {
+            auto & cache = windowsCache[win];
+            cache.wmClass = res;
+            cache.hasClass = true;
+        }
+    }
+
+    return res;
+}
+
+/* XcbEventsPool */
+XcbEventsPool::XcbEventsPool(bool debug, QObject* obj) : QThread(obj), XcbConnection(debug), shutdown(false)
+{
+    // not inherited by the startup cmd
+    if(0 != ::pipe2(wakeupPipe, O_CLOEXEC | O_NONBLOCK))
+        throw std::runtime_error("pipe2");
+
+    connect(this, & XcbEventsPool::xkbStateResetNotify, [this](){ emit xkbNamesChanged(); });
+
+    keymapPool.setMaxThreadCount(1);
+
+    // the xvfb benchmark only
+    statsPath = QString::fromLocal8Bit(qgetenv("QXKB5_STATS"));
+    if(! statsPath.isEmpty())
+        atomStats = getAtom("_QXKB5_STATS");
+}
+
+XcbEventsPool::~XcbEventsPool()
+{
+    shutdown = true;
+    wakeup();
+    wait();
+
+    // the keymap tasks post to the commands
+    keymapPool.waitForDone();
+
+    for(auto fd : wakeupPipe)
+        ::close(fd);
+}
+
+void XcbEventsPool::wakeup(void) const
+{
+    const char byte = 0;
+    // pipe full: the events thread is already woken
+    if(::write(wakeupPipe[1], & byte, 1) < 0 && errno != EAGAIN && toDebug)
+        qWarning() << "wakeup error:" << strerror(errno);
+}
+
+void XcbEventsPool::postCommand(XcbCommand cmd)
+{
+    commands.push(std::move(cmd));
+    wakeup();
+}
+
+int XcbEventsPool::processCommands(void)
+{
+    return commands.consume([](XcbCommand & cmd){ cmd(); });
+}
+
+void XcbEventsPool::switchXkbLayoutAsync(int layout)
+{
+    postCommand([this, layout]()
+    {
+        XcbConnection::switchXkbLayout(layout);
+    });
+}
+
+void XcbEventsPool::setHotkeysAsync(std::vector<XcbHotkey> list)
+{
+    postCommand([this, list = std::move(list)]()
+    {
+        // the old grabs released first
+        hotkeys = list;
+        XcbConnection::grabHotkeys();
+    });
+}
+
+void XcbEventsPool::applyXkbRulesAsync(const QStringList & names)
+{
+    // rules file parsed not on the events thread
+    keymapPool.start(new XcbTask([this, names]()
+    {
+        XkbRules rules;
+        XkbComponents comps;
+
+        if(rules.load(XkbRules::rulesPath(names.value(0))))
+            comps = rules.resolve(names.value(1), names.value(2), names.value(3), names.value(4));
+
+        postCommand([this, names, comps]()
+        {
+            if(comps.symbols.isEmpty() || ! xkbRulesSend(comps, names))
+                emit xkbRulesApplied(false);
+        });
+    }));
+}
+
+bool XcbEventsPool::xkbRulesSend(const XkbComponents & comps, const QStringList & names)
+{
+    if(toDebug) {
+        qWarning() << "xkb components:" << comps.keycodes << comps.types << comps.compat << comps.symbols << comps.geometry;
+    }
+
+    // counted strings: keymaps, keycodes, types, compat, symbols, geometry
+    QByteArray specs;
+
+    for(auto & spec : { QString(), comps.keycodes, comps.types, comps.compat, comps.symbols, comps.geometry })
+    {
+        auto str = spec.toLatin1();
+        if(255 < str.size())
+            return false;
+
+        specs.append(static_cast<char>(str.size())).append(str);
+    }
+
+    // request padding
+    specs.append(QByteArray(-specs.size() & 3, 0));
+
+    // not generated by xcb-xkb with the strings: raw request
+    xcb_xkb_get_kbd_by_name_request_t req{};
+    req.deviceSpec = XCB_XKB_ID_USE_CORE_KBD;
+    req.want = XCB_XKB_GBN_DETAIL_TYPES | XCB_XKB_GBN_DETAIL_COMPAT_MAP | XCB_XKB_GBN_DETAIL_CLIENT_SYMBOLS | XCB_XKB_GBN_DETAIL_SERVER_SYMBOLS |
+                XCB_XKB_GBN_DETAIL_INDICATOR_MAPS | XCB_XKB_GBN_DETAIL_KEY_NAMES | XCB_XKB_GBN_DETAIL_GEOMETRY | XCB_XKB_GBN_DETAIL_OTHER_NAMES;
+    req.need = req.want & ~XCB_XKB_GBN_DETAIL_GEOMETRY;
+    req.load = 1;
+
+    struct iovec parts[4];
+    parts[2].iov_base = & req;
+    parts[2].iov_len = sizeof(req);
+    parts[3].iov_base = specs.data();
+    parts[3].iov_len = specs.size();
+
+    xcb_protocol_request_t proto = { 2, & xcb_xkb_id, XCB_XKB_GET_KBD_BY_NAME, 0 };
+
+    // the previous reply not needed
+    if(xkbRulesSequence)
+        xcb_discard_reply(conn.get(), xkbRulesSequence);
+
+    xkbRulesSequence = xcb_send_request(conn.get(), XCB_REQUEST_CHECKED, parts + 2, & proto);
+
+    // rules names, as setxkbmap: written after the keymap loaded
+    xkbRulesValue.clear();
+    for(auto & name : names)
+        xkbRulesValue.append(name.toLatin1()).append('\0');
+
+    return true;
+}
+
+void XcbEventsPool::xkbRulesReply(void)
+{
+    if(0 == xkbRulesSequence)
+        return;
+
+    void* ptr = nullptr;
+    xcb_generic_error_t* err = nullptr;
+
+    // the reply read with the events
+    if(0 == xcb_poll_for_reply(conn.get(), xkbRulesSequence, & ptr, & err))
+        return;
+
+    auto reply = GenericReply<xcb_xkb_get_kbd_by_name_reply_t>(static_cast<xcb_xkb_get_kbd_by_name_reply_t*>(ptr));
+    auto error = GenericError(err);
+
+    xkbRulesSequence = 0;
+
+    if(error)
+        qWarning() << error.toString("xcb_xkb_get_kbd_by_name");
+
+    bool loaded = reply && reply->loaded;
+
+    // the names describe the loaded keymap only
+    if(loaded)
+    {
+        auto cookie = xcb_change_property(conn.get(), XCB_PROP_MODE_REPLACE, root, atomXkbRulesNames, XCB_ATOM_STRING, 8, xkbRulesValue.size(), xkbRulesValue.constData());
+        requestSent(cookie.sequence, "xcb_change_property");
+    }
+
+    xkbRulesValue.clear();
+    emit xkbRulesApplied(loaded);
+}
+
+void XcbEventsPool::wmStateReply(void)
+{
+    while(! wmStateRequests.empty())
+    {
+        void* ptr = nullptr;
+        xcb_generic_error_t* err = nullptr;
+
+        // the replies in order: the first not read, the next also
+        if(0 == xcb_poll_for_reply(conn.get(), wmStateRequests.front().second, & ptr, & err))
+            return;
+
+        auto win = wmStateRequests.front().first;
+        wmStateRequests.pop_front();
+
+        auto reply = XcbPropertyReply(static_cast<xcb_get_property_reply_t*>(ptr));
+        auto error = GenericError(err);
 
-    xcb_flush(conn.get());
+        // destroyed: released from DestroyNotify
+        if(error)
+            continue;
+
+        // ICCCM WM_STATE: WithdrawnState = 0, NormalState = 1, IconicState = 3
+        // iconified, other desktop or the state not yet removed: kept, released on destroy
+        if(! reply || reply->type != atomWmState || reply.length() < 4 ||
+            0 == *static_cast<uint32_t*>(reply.value()))
+            emit windowDestroyNotify(win);
+    }
 }
 
-QString XcbConnection::getAtomName(xcb_atom_t atom) const
+void XcbEventsPool::setWindowNameAsync(xcb_window_t win, const QString & title)
 {
-    auto xcbReply = getReplyFunc2(xcb_get_atom_name, conn.get(), atom);
-
-    if(auto & reply = xcbReply.reply())
+    postCommand([this, win, title = title.toStdString()]()
     {
-        const char* name = xcb_get_atom_name_name(reply.get());
-        size_t len = xcb_get_atom_name_name_length(reply.get());
-        return QString(QByteArray(name, len));
-    }
+        // the client title notify pending: decorated from the new title after
+        if(! titlePending.value(win).changed)
+            XcbConnection::setWindowName(win, title);
+    });
+}
 
-    return QString("NONE");
+void XcbEventsPool::setWindowEventsAsync(xcb_window_t win, uint32_t mask)
+{
+    postCommand([this, win, mask]()
+    {
+        XcbConnection::setWindowEvents(win, mask);
+    });
 }
 
-xcb_atom_t XcbConnection::getAtom(const QString & name, bool create) const
+void XcbEventsPool::activeWindowUpdate(xcb_window_t prev, xcb_window_t win)
 {
-    auto xcbReply = getReplyFunc2(xcb_intern_atom, conn.get(), create ? 0 : 1, name.length(), name.toStdString().c_str());
+    // tracking: DestroyNotify/UnmapNotify for the window layouts
+    if(prev != XCB_WINDOW_NONE && prev != win)
+        setWindowEvents(prev, windowsTracking ? XCB_EVENT_MASK_STRUCTURE_NOTIFY : XCB_EVENT_MASK_NO_EVENT);
 
-    if(xcbReply.error())
-        return XCB_ATOM_NONE;
+    // select before fetch, the changes after are notified
+    setWindowEvents(win, activeWindowMask);
+    prefetchWindow(win);
 
-    return xcbReply.reply() ? xcbReply.reply()->atom : XCB_ATOM_NONE;
+    emit activeWindowNotify(win);
 }
 
-xcb_window_t XcbConnection::getActiveWindow(void) const
+void XcbEventsPool::setTitleCoalesce(int ms)
 {
-    return getPropertyWindow(root, atomActiveWindow);
+    titleCoalesceMs = std::max(0, ms);
 }
 
-QString XcbConnection::getSymbolsLabel(void) const
+void XcbEventsPool::setWindowsTracking(bool f)
 {
-    auto xcbReply = getReplyFunc2(xcb_xkb_get_names, conn.get(), XCB_XKB_ID_USE_CORE_KBD, XCB_XKB_NAME_DETAIL_GROUP_NAMES | XCB_XKB_NAME_DETAIL_SYMBOLS);
+    windowsTracking = f;
+}
 
-    if(xcbReply.error())
-        throw std::runtime_error("xcb_xkb_get_names");
+uint64_t XcbEventsPool::getTitleNotifyReceived(void) const
+{
+    return titleNotifyReceived;
+}
 
-    if(auto & reply = xcbReply.reply())
+uint64_t XcbEventsPool::getTitleNotifyFolded(void) const
+{
+    return titleNotifyFolded;
+}
+
+void XcbEventsPool::titleNotifyPush(xcb_window_t win)
+{
+    titleNotifyReceived++;
+
+    // inside the coalesce time: one notify after
+    auto it = titlePending.find(win);
+    if(it != titlePending.end())
     {
-        const void *buffer = xcb_xkb_get_names_value_list(reply.get());
-        xcb_xkb_get_names_value_list_t list;
+        if(it->changed)
+            titleNotifyFolded++;
 
-        xcb_xkb_get_names_value_list_unpack(buffer, reply->nTypes, reply->indicators, reply->virtualMods,
-                                            reply->groupNames, reply->nKeys, reply->nKeyAliases, reply->nRadioGroups, reply->which, & list);
-        return getAtomName(list.symbolsName);
+        it->changed = true;
+        return;
     }
 
-    return nullptr;
+    // the first: without delay
+    if(0 < titleCoalesceMs)
+        titlePending.insert(win, XcbTitlePending{ std::chrono::steady_clock::now() + std::chrono::milliseconds(titleCoalesceMs.load()) });
+
+    titleNotifyEmit(win);
 }
 
-QStringList XcbConnection::getXkbNames(void) const
+void XcbEventsPool::titleNotifyEmit(xcb_window_t win)
 {
-    auto xcbReply = getReplyFunc2(xcb_xkb_get_names, conn.get(), XCB_XKB_ID_USE_CORE_KBD, XCB_XKB_NAME_DETAIL_GROUP_NAMES | XCB_XKB_NAME_DETAIL_SYMBOLS);
+    // the last title
+    prefetchWindow(win);
+    emit windowTitleNotify(win);
 
-    if(xcbReply.error())
-        throw std::runtime_error("xcb_xkb_get_names");
+    if(toDebug) {
+        qWarning() << QString("title notify - window: 0x%1, received: %2, folded: %3").
+            arg(win, 8, 16, QChar('0')).arg((qulonglong) titleNotifyReceived).arg((qulonglong) titleNotifyFolded);
+    }
+}
 
-    QStringList res;
-    if(auto & reply = xcbReply.reply())
+void XcbEventsPool::titleNotifyFlush(void)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    for(auto it = titlePending.begin(); it != titlePending.end(); )
     {
-        const void *buffer = xcb_xkb_get_names_value_list(reply.get());
-        xcb_xkb_get_names_value_list_t list;
+        if(now < it->deadline)
+        {
+            ++it;
+            continue;
+        }
 
-        xcb_xkb_get_names_value_list_unpack(buffer, reply->nTypes, reply->indicators, reply->virtualMods,
-                                            reply->groupNames, reply->nKeys, reply->nKeyAliases, reply->nRadioGroups, reply->which, & list);
-        int groups = xcb_xkb_get_names_value_list_groups_length(reply.get(), & list);
+        // quiet: the coalesce time closed
+        if(! it->changed)
+        {
+            it = titlePending.erase(it);
+            continue;
+        }
 
-        for(int ii = 0; ii < groups; ++ii)
-            res << getAtomName(list.groups[ii]);
-    }
+        // storm: the next coalesce time
+        it->deadline = now + std::chrono::milliseconds(titleCoalesceMs.load());
+        it->changed = false;
 
-    return res;
+        titleNotifyEmit(it.key());
+        ++it;
+    }
 }
 
-bool XcbConnection::switchXkbLayout(int layout)
+int XcbEventsPool::titleNotifyTimeout(void) const
 {
-    // next
-    if(layout < 0)
-    {
-        auto names = getXkbNames();
-        layout = (getXkbLayout() + 1) % names.size();
-    }
+    if(titlePending.isEmpty())
+        return -1;
 
-    auto cookie = xcb_xkb_latch_lock_state_checked(conn.get(), XCB_XKB_ID_USE_CORE_KBD, 0, 0, 1, layout, 0, 0, 0);
-    if(! GenericError(xcb_request_check(conn.get(), cookie)))
-        return true;
+    auto now = std::chrono::steady_clock::now();
+    auto next = std::min_element(titlePending.begin(), titlePending.end(), [](const XcbTitlePending & a, const XcbTitlePending & b)
+    {
+        return a.deadline < b.deadline;
+    })->deadline;
 
-    return false;
-}
+    if(next <= now)
+        return 0;
 
-int XcbConnection::getDeviceId(void) const
-{
-    return xkbdevid;
+    // round up, not wake early
+    return std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
 }
 
-int XcbConnection::getXkbLayout(void) const
+int XcbEventsPool::eventsTimeout(void) const
 {
-    auto xcbReply = getReplyFunc2(xcb_xkb_get_state, conn.get(), XCB_XKB_ID_USE_CORE_KBD);
+    int timeout = titleNotifyTimeout();
 
-    if(xcbReply.error())
-        throw std::runtime_error("xcb_xkb_get_state");
+    if(keymapPending)
+    {
+        auto now = std::chrono::steady_clock::now();
+        int keymap = keymapDeadline <= now ? 0 :
+                        std::chrono::ceil<std::chrono::milliseconds>(keymapDeadline - now).count();
 
-    if(auto & reply = xcbReply.reply())
-        return reply->group;
+        if(timeout < 0 || keymap < timeout)
+            timeout = keymap;
+    }
 
-    return 0;
+    return timeout;
 }
 
-XcbPropertyReply XcbConnection::getPropertyAnyType(xcb_window_t win, xcb_atom_t prop, uint32_t offset, uint32_t length) const
+void XcbEventsPool::keymapPush(void)
 {
-    auto xcbReply = getReplyFunc2(xcb_get_property, conn.get(), false, win, prop, XCB_GET_PROPERTY_TYPE_ANY, offset, length);
-
-    if(auto & err = xcbReply.error()) {
-        if(toDebug) {
-            qWarning() << err.toString("xcb_get_property");
-        }
-    }
-        
-    return XcbPropertyReply(std::move(xcbReply.first));
+    // restart the quiet time: setxkbmap and hotplug send the bursts
+    keymapDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(250);
+    keymapPending = true;
 }
 
-xcb_atom_t XcbConnection::getPropertyType(xcb_window_t win, xcb_atom_t prop) const
+static QString keymapCacheFile(const QByteArray & key)
 {
-    auto reply = getPropertyAnyType(win, prop, 0, 0);
-    return reply ? reply->type : (xcb_atom_t) XCB_ATOM_NONE;
+    // the format version: the older files not matched, pruned by age
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).
+        filePath(QString("keymaps/%1.v3.xkb").arg(QString(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex())));
 }
 
-QString XcbConnection::getWindowName(xcb_window_t win) const
+void XcbEventsPool::keymapRebuild(void)
 {
-    QString res = getPropertyString(win, atomNetWmName);
+    keymapPending = false;
+    keymapGeneration++;
 
-    if(res.isEmpty())
+    // the older requests not needed
+    for(auto & seq : keymapSequences)
     {
-        if(atomUtf8String == getPropertyType(win, atomNetWmName))
-        {
-            if(auto reply = getPropertyAnyType(win, atomNetWmName, 0, 8192))
-            {
-                auto ptr = reinterpret_cast<const char*>(reply.value());
-                if(ptr) res.append(ptr);
-            }
-        }
+        if(seq)
+            xcb_discard_reply(conn.get(), seq);
+        seq = 0;
     }
 
-    return res;
+    auto setup = xcb_get_setup(conn.get());
+
+    // the key: the rules names and the core mapping, the replies read with the events
+    keymapSequences[0] = xcb_get_property(conn.get(), false, root, atomXkbRulesNames, XCB_GET_PROPERTY_TYPE_ANY, 0, 1024).sequence;
+    keymapSequences[1] = xcb_get_keyboard_mapping(conn.get(), setup->min_keycode, setup->max_keycode - setup->min_keycode + 1).sequence;
+    keymapSequences[2] = xcb_get_modifier_mapping(conn.get()).sequence;
 }
 
-void XcbConnection::setWindowEvents(xcb_window_t win, uint32_t mask)
+void XcbEventsPool::keymapReply(void)
 {
-    const uint32_t values[] = { mask };
-    auto cookie = xcb_change_window_attributes_checked(conn.get(), win, XCB_CW_EVENT_MASK, values);
+    if(0 == keymapSequences.back())
+        return;
 
-    if(auto err = checkRequest(cookie)) {
-        if(toDebug) {
-            qWarning() << err.toString("xcb_change_window_attributes");
-        }
+    void* ptr = nullptr;
+    xcb_generic_error_t* err = nullptr;
+
+    // the replies in order: the last read, the others before
+    if(0 == xcb_poll_for_reply(conn.get(), keymapSequences.back(), & ptr, & err))
+        return;
+
+    if(auto error = GenericError(err))
+        qWarning() << error.toString("keymap request");
+
+    std::array<void*, 3> replies{};
+    replies.back() = ptr;
+
+    for(size_t it = 0; it + 1 < replies.size(); ++it)
+    {
+        err = nullptr;
+        xcb_poll_for_reply(conn.get(), keymapSequences[it], & replies[it], & err);
+
+        if(auto error = GenericError(err))
+            qWarning() << error.toString("keymap request");
     }
-}
 
-GenericError XcbConnection::checkRequest(const xcb_void_cookie_t & cookie) const
-{
-    return GenericError(xcb_request_check(conn.get(), cookie));
-}
+    keymapSequences.fill(0);
 
-bool XcbConnection::setWindowName(xcb_window_t win, const std::string & title)
-{
-    // set wm name
-    auto cookie = xcb_change_property(conn.get(), XCB_PROP_MODE_REPLACE, win, atomNetWmName, atomUtf8String, 8, title.size(), title.data());
+    auto names = GenericReply<xcb_get_property_reply_t>(static_cast<xcb_get_property_reply_t*>(replies[0]));
+    auto mapping = GenericReply<xcb_get_keyboard_mapping_reply_t>(static_cast<xcb_get_keyboard_mapping_reply_t*>(replies[1]));
+    auto modifiers = GenericReply<xcb_get_modifier_mapping_reply_t>(static_cast<xcb_get_modifier_mapping_reply_t*>(replies[2]));
+
+    QByteArray key;
+
+    // rules, model, layout, variant, options
+    if(names && names->type == XCB_ATOM_STRING && mapping && modifiers)
+        key.append(static_cast<const char*>(xcb_get_property_value(names.get())), xcb_get_property_value_length(names.get()));
 
-    if(auto err = checkRequest(cookie))
+    if(! key.isEmpty())
     {
-        if(toDebug) {
-            qWarning() << err.toString("xcb_change_property");
-        }
-        return false;
+        QFileInfo rules(XkbRules::rulesPath(QString::fromLatin1(key.left(key.indexOf('\0')))));
+
+        // the server upgrade can change the keymap with the same names
+        if(auto setup = xcb_get_setup(conn.get()))
+            key.append(QByteArray::number(setup->release_number));
+
+        // xkeyboard-config upgrade: the rules file changed
+        key.append(QByteArray::number(rules.lastModified().toSecsSinceEpoch())).append(QByteArray::number(rules.size()));
+
+        // the local changes with the same names: xmodmap, xkbcomp
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(QByteArray::fromRawData(reinterpret_cast<const char*>(xcb_get_keyboard_mapping_keysyms(mapping.get())),
+                        xcb_get_keyboard_mapping_keysyms_length(mapping.get()) * sizeof(xcb_keysym_t)));
+        hash.addData(QByteArray::fromRawData(reinterpret_cast<const char*>(xcb_get_modifier_mapping_keycodes(modifiers.get())),
+                        xcb_get_modifier_mapping_keycodes_length(modifiers.get())));
+        key.append(hash.result());
     }
 
-    return true;
+    keymapLoad(key);
 }
 
-QString XcbConnection::getPropertyString(xcb_window_t win, xcb_atom_t prop) const
+void XcbEventsPool::keymapLoad(const QByteArray & key)
 {
-    if(XCB_ATOM_STRING == getPropertyType(win, prop))
+    // without rules names: not cached
+    if(key.isEmpty())
     {
-        if(auto reply = getPropertyAnyType(win, prop, 0, 8192))
+        keymapDevice(key);
+        return;
+    }
+
+    // memory cache
+    auto it = keymapCache.find(key);
+    if(it != keymapCache.end())
+    {
+        keymapInstall(key, it.value());
+        return;
+    }
+
+    // disk cache: compile from string, not on the events thread
+    auto file = keymapCacheFile(key);
+    if(! QFile::exists(file))
+    {
+        keymapDevice(key);
+        return;
+    }
+
+    auto generation = keymapGeneration;
+
+    keymapPool.start(new XcbTask([this, key, file, generation]()
+    {
+        XkbKeymapPtr map;
+        QFile fs(file);
+
+        if(fs.open(QIODevice::ReadOnly))
         {
-            auto ptr = reinterpret_cast<const char*>(reply.value());
-            if(ptr) return QString(ptr);
+            auto str = fs.readAll();
+            // xkb_context is not thread safe, own context
+            if(auto ctx = xkb_context_new(XKB_CONTEXT_NO_FLAGS))
+            {
+                map.reset(xkb_keymap_new_from_string(ctx, str.constData(), XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS), xkb_keymap_unref);
+                xkb_context_unref(ctx);
+            }
         }
-    }
 
-    return nullptr;
+        if(! map)
+        {
+            qWarning() << "keymap cache invalid:" << file;
+            fs.remove();
+        }
+
+        // moved: the keymap released on the events thread only
+        postCommand([this, key, map = std::move(map), generation]()
+        {
+            // the newer MapNotify rebuilt
+            if(generation != keymapGeneration)
+                return;
+
+            if(map)
+                keymapInstall(key, map);
+            else
+                keymapDevice(key);
+        });
+    }));
 }
 
-xcb_window_t XcbConnection::getPropertyWindow(xcb_window_t win, xcb_atom_t prop, uint32_t offset) const
+void XcbEventsPool::keymapDevice(const QByteArray & key)
 {
-    auto xcbReply = getReplyFunc2(xcb_get_property, conn.get(), false, win, prop, XCB_ATOM_WINDOW, offset, 1);
+    XkbKeymapPtr map;
 
-    if(xcbReply.error())
-        return XCB_WINDOW_NONE;
+    // the device fetch: on the events thread, the single owner of the connection
+    if(auto ctx = xkb_context_new(XKB_CONTEXT_NO_FLAGS))
+    {
+        map.reset(xkb_x11_keymap_new_from_device(ctx, conn.get(), xkbdevid, XKB_KEYMAP_COMPILE_NO_FLAGS), xkb_keymap_unref);
+        xkb_context_unref(ctx);
+    }
 
-    if(auto & reply = xcbReply.reply())
+    if(! map)
     {
-        if(auto res = static_cast<xcb_window_t*>(xcb_get_property_value(reply.get())))
-            return *res;
+        qWarning() << "xkb_x11_keymap_new_from_device failed";
+        return;
     }
 
-    return XCB_WINDOW_NONE;
-}
+    keymapInstall(key, map);
 
-QStringList XcbConnection::getPropertyStringList(xcb_window_t win, xcb_atom_t prop) const
-{
-    auto xcbReply = getReplyFunc2(xcb_get_property, conn.get(), false, win, prop, XCB_ATOM_STRING, 0, ~0);
-    QStringList res;
+    if(key.isEmpty())
+        return;
 
-    if(xcbReply.error())
-        return res;
+    char* str = xkb_keymap_get_as_string(map.get(), XKB_KEYMAP_FORMAT_TEXT_V1);
+    if(! str)
+        return;
 
-    if(auto & reply = xcbReply.reply())
+    QByteArray text(str);
+    std::free(str);
+
+    // the disk cache: written not on the events thread
+    keymapPool.start(new XcbTask([file = keymapCacheFile(key), text]()
     {
-        int len = xcb_get_property_value_length(reply.get());
-        auto ptr = static_cast<const char*>(xcb_get_property_value(reply.get()));
+        auto dir = QFileInfo(file).absoluteDir();
+        dir.mkpath(".");
 
-        for(auto & ba : QByteArray(ptr, len - (ptr[len - 1] ? 0 : 1 /* remove last nul */)).split(0))
-            res << QString(ba);
-    }
+        QSaveFile fs(file);
 
-    return res;
+        if(fs.open(QIODevice::WriteOnly))
+        {
+            fs.write(text);
+            fs.commit();
+        }
+
+        // the stale versions and the old keys
+        auto expired = QDateTime::currentDateTime().addDays(-30);
+        for(auto & info : dir.entryInfoList(QStringList() << "*.xkb", QDir::Files))
+        {
+            if(info.lastModified() < expired)
+                QFile::remove(info.absoluteFilePath());
+        }
+    }));
 }
 
-/* XcbEventsPool */
-XcbEventsPool::XcbEventsPool(bool debug, QObject* obj) : QThread(obj), XcbConnection(debug), shutdown(false)
+void XcbEventsPool::keymapInstall(const QByteArray & key, XkbKeymapPtr map)
 {
-    connect(this, & XcbEventsPool::xkbStateResetNotify, [this](){ emit xkbNamesChanged(); });
+    if(! key.isEmpty())
+    {
+        // a few keyboards only
+        if(8 < keymapCache.size())
+            keymapCache.clear();
+
+        keymapCache.insert(key, map);
+    }
+
+    if(toDebug) {
+        qWarning() << "reset map state!";
+    }
+
+    // free state first
+    xkbstate.reset();
+    xkbmap.reset(xkb_keymap_ref(map.get()));
+    xkbstate.reset(xkb_state_new(xkbmap.get()));
+
+    // the mods updated from the next state notify
+    xkb_state_update_mask(xkbstate.get(), 0, 0, 0, 0, 0, xkbGroup);
+
+    loadXkbNames();
+
+    // the keycodes can be changed
+    grabHotkeys();
+
+    emit xkbStateResetNotify();
 }
 
-XcbEventsPool::~XcbEventsPool()
+void XcbEventsPool::statsWrite(void) const
 {
-    shutdown = true;
-    if(! wait(1000))
+    QJsonObject jo;
+
+    jo.insert("replies", static_cast<qint64>(statsReplies));
+    jo.insert("wakeups", static_cast<qint64>(statsWakeups));
+    jo.insert("events", static_cast<qint64>(statsEvents));
+    jo.insert("title:received", static_cast<qint64>(titleNotifyReceived));
+    jo.insert("title:folded", static_cast<qint64>(titleNotifyFolded));
+    std::unique_lock<std::mutex> lock(windowsLock);
+    jo.insert("windows:cached", windowsCache.size());
+    lock.unlock();
+
+    QSaveFile file(statsPath);
+    if(! file.open(QIODevice::WriteOnly))
     {
-        terminate();
-        wait();
+        qWarning() << "error open file" << statsPath;
+        return;
     }
+
+    file.write(QJsonDocument(jo).toJson());
+    file.commit();
+}
+
+void XcbEventsPool::eventsQueued(void) const
+{
+    statsReplies++;
+
+    // the gui thread has read socket, the events thread can sleep with queued events
+    if(QThread::currentThread() != this)
+        wakeup();
 }
 
 void XcbEventsPool::run(void)
@@ -1209,13 +2769,24 @@ void XcbEventsPool::run(void)
     // check current active window
     auto activeWindow = getActiveWindow();
     if(activeWindow != XCB_WINDOW_NONE)
-        emit activeWindowNotify(activeWindow);
+        activeWindowUpdate(XCB_WINDOW_NONE, activeWindow);
+
+    // startup keymap, from the cache if possible
+    keymapRebuild();
+
+    const int xcbFd = xcb_get_file_descriptor(conn.get());
 
     // events
     while(true)
     {
+        // commands from the gui thread, the last before shutdown
+        processCommands();
+
         if(shutdown)
+        {
+            xcb_flush(conn.get());
             break;
+        }
 
         if(int err = xcb_connection_has_error(conn.get()))
         {
@@ -1224,19 +2795,36 @@ void XcbEventsPool::run(void)
             break;
         }
 
+        // before events: the replies can queue the new events
+        titleNotifyFlush();
+
+        if(keymapPending && keymapDeadline <= std::chrono::steady_clock::now())
+            keymapRebuild();
+
         while(auto ev = GenericEvent(xcb_poll_for_event(conn.get())))
         {
             auto type = ev ? ev->response_type & ~0x80 : 0;
+            statsEvents++;
+
+            // KeymapNotify: without sequence
+            if(XCB_KEYMAP_NOTIFY != type)
+                ownTitleExpire(ev->sequence);
+
+            // errors from the unchecked requests
             if(type == 0)
+            {
+                requestError(ev.toerror());
                 continue;
-
-            bool resetMapState = false;
+            }
 
             if(XCB_KEY_PRESS == type)
             {
                 if(auto kp = reinterpret_cast<xcb_key_press_event_t*>(ev.get()))
                 {
-                    emit keycodePressNotify(kp->detail, kp->state);
+                    // from the passive grabs only
+                    int id = findHotkey(kp->detail, kp->state);
+                    if(0 <= id)
+                        emit hotkeyNotify(id);
                 }
             }
             else
@@ -1250,19 +2838,59 @@ void XcbEventsPool::run(void)
                         // changed property: active window
                         if(pn->atom == atomActiveWindow)
                         {
-                            activeWindow = getActiveWindow();
-                            if(activeWindow != XCB_WINDOW_NONE)
-                                emit activeWindowNotify(activeWindow);
+                            auto win = getActiveWindow();
+                            if(win != XCB_WINDOW_NONE)
+                            {
+                                activeWindowUpdate(activeWindow, win);
+                                activeWindow = win;
+                            }
+                        }
+                        else
+                        // changed property: xkb rules, setxkbmap
+                        if(pn->atom == atomXkbRulesNames)
+                        {
+                            loadXkbRulesNames();
+                            emit xkbRulesChanged();
+                        }
+                        else
+                        if(pn->atom == atomStats && atomStats != XCB_ATOM_NONE)
+                        {
+                            statsWrite();
                         }
                     }
                     // other window
                     else
+                    // own title write: the cache is updated, skip
+                    if(pn->atom != atomNetWmName || ! ownTitleNotify(pn->window, pn->sequence))
                     {
+                        windowCacheInvalidate(pn->window, pn->atom);
+
                         // changed property: wm name
                         if(pn->atom == atomNetWmName)
-                        {
-                            emit windowTitleNotify(pn->window);
-                        }
+                            titleNotifyPush(pn->window);
+                    }
+                }
+            }
+            else
+            if(XCB_DESTROY_NOTIFY == type)
+            {
+                if(auto dn = reinterpret_cast<xcb_destroy_notify_event_t*>(ev.get()))
+                {
+                    windowCacheRemove(dn->window);
+                    titlePending.remove(dn->window);
+                    emit windowDestroyNotify(dn->window);
+                }
+            }
+            else
+            if(XCB_UNMAP_NOTIFY == type)
+            {
+                if(auto un = reinterpret_cast<xcb_unmap_notify_event_t*>(ev.get()))
+                {
+                    // withdrawn: released with the WM_STATE reply, without wait
+                    if(windowsTracking)
+                    {
+                        auto cookie = xcb_get_property(conn.get(), false, un->window, atomWmState, atomWmState, 0, 1);
+                        wmStateRequests.emplace_back(un->window, cookie.sequence);
                     }
                 }
             }
@@ -1304,7 +2932,7 @@ typedef struct xcb_xkb_map_notify_event_t {
 } xcb_xkb_map_notify_event_t;
 */
 
-                        resetMapState = true;
+                        keymapPush();
 
 			if(toDebug) {
         		    qWarning() << QString("new map notify - xkbType: %1, deviceID: %2, ptrBtnActions: 0x%3, keyCode: (%4, %5), chaged: 0x%6, time: %7").
@@ -1342,7 +2970,7 @@ typedef struct xcb_xkb_new_keyboard_notify_event_t {
 } xcb_xkb_new_keyboard_notify_event_t;
 */
                         //if(kn->deviceID == xkbdevid && (kn->changed & XCB_XKB_NKN_DETAIL_KEYCODES))
-                        //    resetMapState = true;
+                        //    keymapPush();
 
 			// changed: XCB_XKB_NKN_DETAIL_KEYCODES = 1, XCB_XKB_NKN_DETAIL_GEOMETRY = 2, XCB_XKB_NKN_DETAIL_DEVICE_ID  = 4
 
@@ -1425,32 +3053,70 @@ typedef struct xcb_xkb_state_notify_event_t {
 			        arg((int) sn->time);
 			}
 
-                        xkb_state_update_mask(xkbstate.get(), sn->baseMods, sn->latchedMods, sn->lockedMods,
+                        // the keymap can be loading
+                        if(xkbstate)
+                            xkb_state_update_mask(xkbstate.get(), sn->baseMods, sn->latchedMods, sn->lockedMods,
                                                       sn->baseGroup, sn->latchedGroup, sn->lockedGroup);
 
+                        xkbGroup = sn->group;
+
                         if(sn->changed & XCB_XKB_STATE_PART_GROUP_STATE)
                             emit xkbStateNotify(sn->group);
                     }
 
                 }
-
-                if(resetMapState)
+                else
+                if(xkbev == XCB_XKB_NAMES_NOTIFY)
                 {
-		    qWarning() << "reset map state!";
-
-                    // free state first
-                    xkbstate.reset();
-                    xkbmap.reset();
-
-                    // set new
-                    xkbmap.reset(xkb_x11_keymap_new_from_device(xkbctx.get(), conn.get(), xkbdevid, XKB_KEYMAP_COMPILE_NO_FLAGS));
-                    xkbstate.reset(xkb_x11_state_new_from_device(xkbmap.get(), conn.get(), xkbdevid));
+                    if(auto nn = reinterpret_cast<xcb_xkb_names_notify_event_t*>(ev.get()))
+                    {
+                        if(toDebug) {
+                            qWarning() << QString("new names notify - xkbType: %1, deviceID: %2, changed: 0x%3, groupNames: 0x%4, time: %5").
+                                arg((int) nn->xkbType).
+                                arg((int) nn->deviceID).
+                                arg((int) nn->changed, 4, 16, QChar('0')).
+                                arg((int) nn->changedGroupNames, 2, 16, QChar('0')).
+                                arg((int) nn->time);
+                        }
 
-                    emit xkbStateResetNotify();
+                        if(nn->changed & (XCB_XKB_NAME_DETAIL_GROUP_NAMES | XCB_XKB_NAME_DETAIL_SYMBOLS))
+                        {
+                            loadXkbNames();
+                            emit xkbNamesChanged();
+                        }
+                    }
                 }
             }
         }
 
-        msleep(25);
+        xkbRulesReply();
+        keymapReply();
+        wmStateReply();
+
+        if(shutdown)
+            continue;
+
+        xcb_flush(conn.get());
+
+        // wait xcb socket or wakeup
+        pollfd fds[2] = { { xcbFd, POLLIN, 0 }, { wakeupPipe[0], POLLIN, 0 } };
+
+        if(0 > poll(fds, 2, eventsTimeout()))
+        {
+            if(errno == EINTR)
+                continue;
+
+            qWarning() << "poll error:" << strerror(errno);
+            emit shutdownNotify();
+            break;
+        }
+
+        statsWakeups++;
+
+        if(fds[1].revents & POLLIN)
+        {
+            char buf[64];
+            while(0 < ::read(wakeupPipe[0], buf, sizeof(buf)));
+        }
     }
 }
@@ -25,18 +25,22 @@
 
 #define VERSION 20260403
 
+#include <QHash>
 #include <QIcon>
 #include <QList>
 #include <QObject>
 #include <QThread>
+#include <QRunnable>
+#include <QByteArray>
+#include <QThreadPool>
 #include <QWidget>
 #include <QAction>
 #include <QString>
 #include <QPixmap>
 #include <QStringList>
 #include <QCloseEvent>
-#include <QTimerEvent>
 #include <QKeyEvent>
+#include <QProcess>
 #include <QSystemTrayIcon>
 #include <QTreeWidgetItem>
 
@@ -46,16 +50,29 @@
 #include <QSound>
 #endif
 
+#include <array>
+#include <deque>
+#include <vector>
+#include <mutex>
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <functional>
 
 #include "xcb/xcb.h"
+#include "xcb/xcbext.h"
 #define explicit dont_use_cxx_explicit
 #include "xcb/xkb.h"
 #undef explicit
 #include "xkbcommon/xkbcommon-x11.h"
 
+#include "layoutrules.h"
+#include "iconpack.h"
+#include "xkbrules.h"
+#include "rulesjournal.h"
+#include "windowrules.h"
+#include "layoutlabel.h"
+
 namespace Ui {
     class MainSettings;
 }
@@ -95,6 +112,18 @@ ReplyError<Reply> getReply1(std::function<Reply*(xcb_connection_t*, Cookie, xcb_
     return ReplyError<Reply>(reply, error);
 }
 
+template<typename Reply, typename Cookie>
+struct XcbCookie
+{
+    std::function<Reply*(xcb_connection_t*, Cookie, xcb_generic_error_t**)> func;
+    Cookie cookie;
+};
+
+// send request without waiting, the reply is taken later with getReply2(cookie)
+#define sendRequestFunc2(NAME,conn,...) XcbCookie<NAME##_reply_t,NAME##_cookie_t>{NAME##_reply,NAME(conn,##__VA_ARGS__)}
+
+typedef XcbCookie<xcb_get_property_reply_t, xcb_get_property_cookie_t> XcbPropertyCookie;
+
 struct XcbPropertyReply : GenericReply<xcb_get_property_reply_t>
 {
     uint32_t length(void) { return xcb_get_property_value_length(get()); }
@@ -104,11 +133,54 @@ struct XcbPropertyReply : GenericReply<xcb_get_property_reply_t>
     XcbPropertyReply( GenericReply<xcb_get_property_reply_t> && ptr) noexcept : GenericReply<xcb_get_property_reply_t>(std::move(ptr)) {}
 };
 
+struct XcbWindowCache
+{
+    QStringList wmClass;
+    QString name;
+    QHash<xcb_atom_t, xcb_atom_t> types;
+    bool hasClass = false;
+    bool hasName = false;
+};
+
+struct XcbHotkey
+{
+    uint16_t mods = 0;
+    xkb_keysym_t keysym = XKB_KEY_NoSymbol;
+
+    // "Ctrl+Alt+1", "Super+space"
+    static XcbHotkey parse(const QString &);
+};
+
+struct XcbKeyGrab
+{
+    xcb_keycode_t keycode;
+    uint16_t mods;
+    int id;
+};
+
+struct XcbTitleWrite
+{
+    xcb_window_t win;
+    uint32_t sequence;
+};
+
+struct XcbTitlePending
+{
+    std::chrono::steady_clock::time_point deadline;
+    // notified after the deadline
+    bool changed = false;
+};
+
+struct XcbSentRequest
+{
+    uint32_t sequence;
+    const char* name;
+};
+
 struct XcbConnection
 {
 protected:
     std::unique_ptr<xcb_connection_t, decltype(xcb_disconnect)*> conn;
-    std::unique_ptr<xkb_context, decltype(xkb_context_unref)*> xkbctx;
     std::unique_ptr<xkb_keymap, decltype(xkb_keymap_unref)*> xkbmap;
     std::unique_ptr<xkb_state, decltype(xkb_state_unref)*> xkbstate;
     const xcb_query_extension_reply_t* xkbext;
@@ -117,20 +189,75 @@ protected:
     xcb_atom_t atomActiveWindow;
     xcb_atom_t atomNetWmName;
     xcb_atom_t atomUtf8String;
+    xcb_atom_t atomXkbRulesNames = XCB_ATOM_NONE;
+    xcb_atom_t atomWmState = XCB_ATOM_NONE;
     bool toDebug = false;
 
+    // xkb mirror, updated from the xkb events
+    std::atomic<int> xkbGroup{0};
+    mutable std::mutex xkbNamesLock;
+    QStringList xkbGroupNames;
+    QString xkbSymbolsLabel;
+    QStringList xkbRulesNames;
+
+    bool loadXkbNames(void);
+    void loadXkbRulesNames(void);
+
+    // atoms cache, both directions
+    mutable std::mutex atomsLock;
+    mutable QHash<QString, xcb_atom_t> atomsByName;
+    mutable QHash<xcb_atom_t, QString> atomsById;
+
+    // windows properties cache, invalidated from PropertyNotify/DestroyNotify
+    mutable std::mutex windowsLock;
+    mutable QHash<xcb_window_t, XcbWindowCache> windowsCache;
+    uint32_t windowsGeneration = 0;
+
+    void windowCacheInvalidate(xcb_window_t, xcb_atom_t);
+    void windowCacheRemove(xcb_window_t);
+    void windowCacheSetName(xcb_window_t, const QString &);
+
+    // own _NET_WM_NAME writes in the request order, expired by the event sequences:
+    // the windows without PropertyChange selected never notify
+    std::deque<XcbTitleWrite> ownTitleWrites;
+
+    bool ownTitleNotify(xcb_window_t, uint16_t sequence);
+    void ownTitleExpire(uint16_t sequence);
+
+    // passive grabs on root, the keycodes resolved from xkbmap
+    std::vector<XcbHotkey> hotkeys;
+    std::vector<XcbKeyGrab> keyGrabs;
+
+    void grabHotkeys(void);
+    int findHotkey(xcb_keycode_t, uint16_t state) const;
+
+    // the last unchecked requests, for the errors report
+    std::array<XcbSentRequest, 64> sentRequests{};
+    size_t sentRequestsPos = 0;
+
+    void requestSent(uint32_t sequence, const char* name);
+    void requestError(const xcb_generic_error_t*) const;
+
 public:
     XcbConnection(bool debug);
     virtual ~XcbConnection(){}
 
+    // called after a blocking reply, the events may be queued by xcb
+    virtual void eventsQueued(void) const {}
+
     GenericError checkRequest(const xcb_void_cookie_t &) const;
 
     int getXkbLayout(void) const;
     int getDeviceId(void) const;
-    bool switchXkbLayout(int layout = -1);
+    void switchXkbLayout(int layout = -1);
     QStringList getXkbNames(void) const;
+    QStringList getXkbRulesNames(void) const;
 
     xcb_atom_t getAtom(const QString & name, bool create = true) const;
+    QList<xcb_atom_t> getAtoms(const QStringList & names, bool create = true) const;
+
+    XcbPropertyCookie sendGetProperty(xcb_window_t win, xcb_atom_t prop, xcb_atom_t type, uint32_t offset, uint32_t length) const;
+    XcbPropertyReply getProperty(const XcbPropertyCookie &) const;
 
     XcbPropertyReply getPropertyAnyType(xcb_window_t win, xcb_atom_t prop, uint32_t offset, uint32_t length) const;
     xcb_atom_t getPropertyType(xcb_window_t, xcb_atom_t) const;
@@ -140,49 +267,231 @@ public:
     QString getPropertyString(xcb_window_t, xcb_atom_t) const;
 
     QString getAtomName(xcb_atom_t) const;
+    QStringList getAtomNames(const QList<xcb_atom_t> &) const;
 
     QString getWindowName(xcb_window_t) const;
-    bool setWindowName(xcb_window_t, const std::string &);
+    void prefetchWindow(xcb_window_t) const;
+    void setWindowName(xcb_window_t, const std::string &);
 
     void setWindowEvents(xcb_window_t, uint32_t mask);
 
     QString getSymbolsLabel(void) const;
     QStringList getPropertyStringList(xcb_window_t win, xcb_atom_t prop) const;
 
+    // cache only, without requests
+    QStringList cachedWindowClass(xcb_window_t) const;
+    QString cachedWindowName(xcb_window_t) const;
+
     template<typename Reply, typename Cookie>
     ReplyError<Reply> getReply2(std::function<Reply*(xcb_connection_t*, Cookie, xcb_generic_error_t**)> func, Cookie cookie) const
     {
-        return getReply1<Reply, Cookie>(func, conn.get(), cookie);
+        auto res = getReply1<Reply, Cookie>(func, conn.get(), cookie);
+        eventsQueued();
+        return res;
     }
 
-#define getReplyFunc2(NAME,conn,...) getReply2<NAME##_reply_t,NAME##_cookie_t>(NAME##_reply,NAME(conn,##__VA_ARGS__))
+    template<typename Reply, typename Cookie>
+    ReplyError<Reply> getReply2(const XcbCookie<Reply, Cookie> & cookie) const
+    {
+        return getReply2<Reply, Cookie>(cookie.func, cookie.cookie);
+    }
+
+#define getReplyFunc2(NAME,conn,...) getReply2(sendRequestFunc2(NAME,conn,##__VA_ARGS__))
 };
 
-class XcbEventsPool : public QThread, public XcbConnection
+// lock-free queue: multiple producers, single consumer
+template<typename T>
+class LockFreeQueue
+{
+    struct Node
+    {
+        T value;
+        Node* next;
+    };
+
+    std::atomic<Node*> head{nullptr};
+
+public:
+    LockFreeQueue() = default;
+    LockFreeQueue(const LockFreeQueue &) = delete;
+    LockFreeQueue & operator=(const LockFreeQueue &) = delete;
+
+    ~LockFreeQueue()
+    {
+        auto node = head.exchange(nullptr);
+        while(node)
+        {
+            auto next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    void push(T value)
+    {
+        auto node = new Node{ std::move(value), head.load(std::memory_order_relaxed) };
+        while(! head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // consumer: take all, fifo order
+    template<typename Func>
+    int consume(Func func)
+    {
+        auto node = head.exchange(nullptr, std::memory_order_acquire);
+        Node* list = nullptr;
+        int res = 0;
+
+        while(node)
+        {
+            auto next = node->next;
+            node->next = list;
+            list = node;
+            node = next;
+        }
+
+        while(list)
+        {
+            auto next = list->next;
+            func(list->value);
+            delete list;
+            list = next;
+            res++;
+        }
+
+        return res;
+    }
+};
+
+typedef std::function<void(void)> XcbCommand;
+
+struct XcbTask : QRunnable
+{
+    XcbCommand func;
+
+    XcbTask(XcbCommand && cmd) : func(std::move(cmd)) {}
+    void run(void) override { func(); }
+};
+
+typedef std::shared_ptr<xkb_keymap> XkbKeymapPtr;
+
+// the events thread is single owner of the xcb connection,
+// the gui thread uses the xkb mirror, the windows cache and the commands queue
+class XcbEventsPool : public QThread, protected XcbConnection
 {
     Q_OBJECT
 
     std::atomic<bool> shutdown;
+    int wakeupPipe[2] = { -1, -1 };
+    LockFreeQueue<XcbCommand> commands;
+
+    // _NET_WM_NAME storms: the first notify at once, the next folded to one per coalesce time
+    std::atomic<int> titleCoalesceMs{100};
+    std::atomic<uint64_t> titleNotifyReceived{0};
+    std::atomic<uint64_t> titleNotifyFolded{0};
+    QHash<xcb_window_t, XcbTitlePending> titlePending;
+
+    // per window layouts: the inactive windows keep StructureNotify
+    std::atomic<bool> windowsTracking{false};
+    // UnmapNotify: WM_STATE in flight, window and sequence
+    std::deque<std::pair<xcb_window_t, uint32_t>> wmStateRequests;
+
+    // MapNotify bursts: one keymap rebuild after the quiet time, cached by _XKB_RULES_NAMES
+    // and the core mapping, the local changes (xmodmap) with the same names are other keys
+    bool keymapPending = false;
+    std::chrono::steady_clock::time_point keymapDeadline;
+    QHash<QByteArray, XkbKeymapPtr> keymapCache;
+    // the key requests in flight: GetProperty, GetKeyboardMapping, GetModifierMapping
+    std::array<uint32_t, 3> keymapSequences{};
+    // the background results from the older rebuild dropped
+    uint32_t keymapGeneration = 0;
+    QThreadPool keymapPool;
+
+    // GetKbdByName in flight, _XKB_RULES_NAMES value for the reply
+    uint32_t xkbRulesSequence = 0;
+    QByteArray xkbRulesValue;
+
+    // benchmark counters: written to $QXKB5_STATS on the root _QXKB5_STATS change
+    QString statsPath;
+    xcb_atom_t atomStats = XCB_ATOM_NONE;
+    mutable std::atomic<uint64_t> statsReplies{0};
+    uint64_t statsWakeups = 0;
+    uint64_t statsEvents = 0;
+
+    void statsWrite(void) const;
+
+    bool xkbRulesSend(const XkbComponents &, const QStringList & names);
+    void xkbRulesReply(void);
+    void wmStateReply(void);
+
+    void activeWindowUpdate(xcb_window_t prev, xcb_window_t win);
+    int processCommands(void);
+    void titleNotifyPush(xcb_window_t);
+    void titleNotifyEmit(xcb_window_t);
+    void titleNotifyFlush(void);
+    int titleNotifyTimeout(void) const;
+    void keymapPush(void);
+    void keymapRebuild(void);
+    void keymapReply(void);
+    void keymapLoad(const QByteArray & key);
+    void keymapInstall(const QByteArray & key, XkbKeymapPtr);
+    void keymapDevice(const QByteArray & key);
+    int eventsTimeout(void) const;
 
 public:
+    static constexpr uint32_t activeWindowMask = XCB_EVENT_MASK_PROPERTY_CHANGE | XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+
     XcbEventsPool(bool debug, QObject*);
     ~XcbEventsPool();
 
+    void wakeup(void) const;
+    void eventsQueued(void) const override;
+
+    using XcbConnection::getXkbLayout;
+    using XcbConnection::getXkbNames;
+    using XcbConnection::getXkbRulesNames;
+    using XcbConnection::getSymbolsLabel;
+    using XcbConnection::cachedWindowClass;
+    using XcbConnection::cachedWindowName;
+
+    // executed on the events thread, the errors reported from the events
+    void postCommand(XcbCommand);
+    void switchXkbLayoutAsync(int layout = -1);
+    void setWindowNameAsync(xcb_window_t, const QString &);
+    void setWindowEventsAsync(xcb_window_t, uint32_t mask);
+    void setHotkeysAsync(std::vector<XcbHotkey>);
+    // rules, model, layout, variant, options: loaded by the server
+    void applyXkbRulesAsync(const QStringList & names);
+
+    void setTitleCoalesce(int ms);
+    void setWindowsTracking(bool);
+    uint64_t getTitleNotifyReceived(void) const;
+    uint64_t getTitleNotifyFolded(void) const;
+
 protected:
     void run() override;
 
 signals:
-    void keycodePressNotify(int, int);
+    void hotkeyNotify(int);
     void windowTitleNotify(int);
+    // destroyed or withdrawn
+    void windowDestroyNotify(int);
     void activeWindowNotify(int);
     void shutdownNotify(void);
     void xkbNewKeyboardNotify(int);
     void xkbStateNotify(int);
     void xkbStateResetNotify(void);
     void xkbNamesChanged(void);
+    void xkbRulesChanged(void);
+    void xkbRulesApplied(bool);
 };
 
-enum LayoutState { StateNormal, StateFirst, StateFixed };
+enum HotkeyAction { HotkeyLayout, HotkeyCycle, HotkeyState };
+
+struct HotkeyRule
+{
+    int action = HotkeyCycle;
+    int layout = 0;
+};
 
 class MainSettings : public QWidget
 {
@@ -196,15 +505,41 @@ class MainSettings : public QWidget
     QAction* actionSettings = nullptr;
     QAction* actionExit = nullptr;
     QList<QIcon> layoutIcons;
+    // rendered icons: layout name and icon attributes
+    QHash<QString, QIcon> layoutIconsCache;
+    IconPack iconPack;
+    qint64 trayIconKey = 0;
+    LayoutRules cacheRules;
+    RulesJournal cacheJournal;
+    // the cache view, filled only when settings is visible
+    QHash<LayoutRuleKey, QTreeWidgetItem*> cacheViewItems;
+    bool cacheViewActive = false;
 #if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
     QSoundEffect soundClick;
 #else
     QSound soundClick{":/sounds/small2"};
 #endif
     QString startupCmd;
-    QStringList skipClasses;
+    QProcess* startupRunning = nullptr;
+    QString startupApplying;
+    bool startupRepeat = false;
+    // rules changed while the startup cmd runs: checked after
+    bool startupCheck = false;
+    int startupTimeout = 30000;
+    WindowMatcher skipClasses;
+    TitleMatcher titleRules;
+    // title rule of the active window, -1: the class rule
+    int titleRuleActive = -1;
+    // per window layouts, the class rule for the new windows
+    WindowLayouts windowLayouts;
+    bool windowsMemory = false;
+    std::vector<XcbHotkey> hotkeys;
+    QList<HotkeyRule> hotkeyRules;
     xcb_window_t prevWindow = XCB_WINDOW_NONE;
-    int periodicCheckXkbRules = 0;
+    QStringList prevClasses;
+    int titleCoalesce = 100;
+    int cacheCapacity = 1000;
+    int cacheMaxAge = 90;
     bool forceReload = false;
     bool toDebug = false;
 
@@ -216,19 +551,27 @@ protected:
     void closeEvent(QCloseEvent*) override;
     void showEvent(QShowEvent*) override;
     void hideEvent(QHideEvent*) override;
-    void timerEvent(QTimerEvent*) override;
     void keyPressEvent(QKeyEvent*) override;
     QPixmap getLayoutIcon(const QString &);
-    QTreeWidgetItem* cacheFindItem(const QString & class1, const QString & class2);
+    LayoutRule* cacheFindItem(const QString & class1, const QString & class2);
+    void cacheViewUpdate(const LayoutRule &);
+    void cacheItemChanged(const LayoutRule &, bool inserted = false);
+    void cacheItemsEvict(bool expired, const LayoutRuleKey & keep = LayoutRuleKey());
+    void cacheViewRemove(const QString & class1, const QString & class2);
+    void cacheViewReload(void);
     void cacheSaveItems(void);
     void cacheLoadItems(void);
     void configSave(void);
     bool configLoadLocal(void);
     bool configLoadGlobal(const QString &);
     void initXkbLayoutIcons(void);
+    void trayIconUpdate(int index);
     void startupProcess(void);
-    void windowRestoreTitle(xcb_window_t);
+    void startupFinished(QProcess*, const QString &, bool success);
+    void startupSpawn(const QString &);
+    void windowRestoreTitle(xcb_window_t, const QStringList &);
     void windowUpdateTitle(xcb_window_t, const QString &, const QString &);
+    bool titleRuleUpdate(xcb_window_t);
 
 private slots:
     void iconActivated(QSystemTrayIcon::ActivationReason reason);
@@ -237,6 +580,8 @@ private slots:
     void xkbStateChanged(int);
     void xkbNewKeyboardChanged(int);
     void windowTitleChanged(int);
+    void windowDestroyed(int);
+    void hotkeyPressed(int);
     void selectBackgroundColor(void);
     void selectTextColor(void);
     void selectFont(void);
@@ -247,6 +592,8 @@ private slots:
     void allowIconsPath(bool);
     void allowPictureMode(bool);
     void periodicChecked(bool);
+    void xkbRulesCheck(void);
+    void xkbRulesApplied(bool);
     void screenSaverActiveChanged(bool);
 
 signals:
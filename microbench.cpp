@@ -0,0 +1,193 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QGuiApplication>
+
+#include "benchmark/benchmark.h"
+
+#include "layoutrules.h"
+#include "layoutlabel.h"
+#include "windowrules.h"
+#include "rulesjournal.h"
+
+// class1, class2 as the xcb windows
+static LayoutRules rulesFill(int count)
+{
+    LayoutRules rules;
+    rules.reserve(count);
+
+    for(int ii = 0; ii < count; ++ii)
+    {
+        LayoutRule rule;
+        rule.class1 = QString("app-%1").arg(ii);
+        rule.class2 = QString("App-%1").arg(ii);
+        rule.title = QString("window title %1").arg(ii);
+        rule.layout = ii % 2;
+        rule.lastUsed = 1700000000 + ii;
+        rules.insert(rule);
+    }
+
+    return rules;
+}
+
+static void BM_WindowStringList(benchmark::State & state)
+{
+    const QByteArray wmClass("google-chrome\0Google-chrome\0", 28);
+
+    for(auto _ : state)
+        benchmark::DoNotOptimize(windowStringList(wmClass.constData(), wmClass.size()));
+}
+BENCHMARK(BM_WindowStringList);
+
+static void BM_LayoutRulesFind(benchmark::State & state)
+{
+    const int count = state.range(0);
+    auto rules = rulesFill(count);
+
+    // the names as from the windows cache: not case folded
+    QStringList class1, class2;
+    for(int ii = 0; ii < 64; ++ii)
+    {
+        class1 << QString("app-%1").arg(ii * 7919 % count);
+        class2 << QString("App-%1").arg(ii * 7919 % count);
+    }
+
+    int pos = 0;
+    for(auto _ : state)
+    {
+        benchmark::DoNotOptimize(rules.find(class1.at(pos), class2.at(pos)));
+        pos = (pos + 1) % class1.size();
+    }
+}
+BENCHMARK(BM_LayoutRulesFind)->Arg(10)->Arg(1000)->Arg(100000);
+
+static void BM_WindowTitleFormat(benchmark::State & state)
+{
+    const QString format("%{title} [%{label}]");
+    const QString title("qxkb5 - Konsole: ~/src/qxkb5");
+
+    for(auto _ : state)
+        benchmark::DoNotOptimize(windowTitleFormat(format, title, "us"));
+}
+BENCHMARK(BM_WindowTitleFormat);
+
+static void BM_WindowMatcher(benchmark::State & state)
+{
+    WindowMatcher matcher;
+    const int count = state.range(0);
+
+    for(int ii = 0; ii < count; ++ii)
+        matcher.add(ii % 2 ? QString("skip-%1").arg(ii) : QString("glob-%1-*").arg(ii));
+
+    // the negative result cached after the first match
+    const QStringList wmClass = QStringList() << "google-chrome" << "Google-chrome";
+
+    for(auto _ : state)
+        benchmark::DoNotOptimize(matcher.match(wmClass));
+}
+BENCHMARK(BM_WindowMatcher)->Arg(10)->Arg(1000);
+
+static void BM_WindowLayouts(benchmark::State & state)
+{
+    WindowLayouts layouts;
+
+    // the window ids: client base and sequential
+    for(quint32 ii = 0; ii < 256; ++ii)
+        layouts.insert(0x3a00001 + ii * 3, ii % 2);
+
+    quint32 pos = 0;
+    for(auto _ : state)
+    {
+        benchmark::DoNotOptimize(layouts.find(0x3a00001 + pos * 3));
+        pos = (pos + 1) % 256;
+    }
+}
+BENCHMARK(BM_WindowLayouts);
+
+static void BM_LayoutLabelFont(benchmark::State & state)
+{
+    for(auto _ : state)
+        benchmark::DoNotOptimize(layoutLabelFont("Cantarell, 18, 50"));
+}
+BENCHMARK(BM_LayoutLabelFont);
+
+static void BM_LayoutLabelImage(benchmark::State & state)
+{
+    const qreal ratio = state.range(0);
+
+    for(auto _ : state)
+        benchmark::DoNotOptimize(layoutLabelImage("us", "Cantarell, 18, 50", "#191970", "#ffffff", ratio));
+}
+BENCHMARK(BM_LayoutLabelImage)->Arg(1)->Arg(2);
+
+static void BM_RulesSnapshotSave(benchmark::State & state)
+{
+    auto rules = rulesFill(state.range(0));
+
+    for(auto _ : state)
+        benchmark::DoNotOptimize(RulesJournal::snapshotData(rules, 1));
+}
+BENCHMARK(BM_RulesSnapshotSave)->Arg(1000)->Arg(100000);
+
+static void BM_RulesSnapshotLoad(benchmark::State & state)
+{
+    QTemporaryDir tmp;
+    auto path = tmp.filePath("cache");
+
+    QFile file(path);
+    if(! file.open(QIODevice::WriteOnly))
+    {
+        state.SkipWithError("error open file");
+        return;
+    }
+
+    file.write(RulesJournal::snapshotData(rulesFill(state.range(0)), 1));
+    file.close();
+
+    for(auto _ : state)
+    {
+        LayoutRules rules;
+        quint64 sequence = 0;
+
+        benchmark::DoNotOptimize(RulesJournal::snapshotRead(path, rules, sequence));
+    }
+}
+BENCHMARK(BM_RulesSnapshotLoad)->Arg(1000)->Arg(100000);
+
+int main(int argc, char** argv)
+{
+    // fonts and painter without display
+    if(qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+
+    benchmark::Initialize(& argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    benchmark::RunSpecifiedBenchmarks();
+
+    return 0;
+}
@@ -25,9 +25,21 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 
 SOURCES += main.cpp\
-        mainsettings.cpp
-
-HEADERS  += mainsettings.h
+        mainsettings.cpp\
+        layoutrules.cpp\
+        rulesjournal.cpp\
+        windowrules.cpp\
+        layoutlabel.cpp\
+        xkbrules.cpp\
+        iconpack.cpp
+
+HEADERS  += mainsettings.h\
+        layoutrules.h\
+        rulesjournal.h\
+        windowrules.h\
+        layoutlabel.h\
+        xkbrules.h\
+        iconpack.h
 
 FORMS    += mainsettings.ui
 LIBS     += -lxkbcommon -lxkbcommon-x11 -lxcb-xkb -lxcb
@@ -35,4 +47,5 @@ LIBS     += -lxkbcommon -lxkbcommon-x11 -lxcb-xkb -lxcb
 DISTFILES +=
 
 RESOURCES += \
-    resources.qrc
+    resources.qrc \
+    icons.qrc
@@ -0,0 +1,380 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QDir>
+#include <QDebug>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QByteArray>
+#include <QDataStream>
+#include <QRunnable>
+#include <QtEndian>
+
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+#include "rulesjournal.h"
+
+struct RulesTask : QRunnable
+{
+    std::function<void(void)> func;
+
+    RulesTask(std::function<void(void)> && cmd) : func(std::move(cmd)) {}
+    void run(void) override { func(); }
+};
+
+static const int journalHeaderSize = 6;
+
+// snapshot: "QXKBRULE", uint32 version, uint32 count, uint64 sequence
+// entries: int32 layout, int32 state, uint16 size1, uint16 size2, [v3: int64 lastUsed], utf8 class1, utf8 class2
+static const char snapshotMagic[8] = { 'Q', 'X', 'K', 'B', 'R', 'U', 'L', 'E' };
+static const int snapshotHeaderSize = sizeof(snapshotMagic) + 16;
+static const quint32 snapshotVersion = 3;
+
+static quint16 journalChecksum(const QByteArray & data)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    return qChecksum(data, Qt::ChecksumIso3309);
+#else
+    return qChecksum(data.constData(), data.size(), Qt::ChecksumIso3309);
+#endif
+}
+
+RulesJournal::SnapshotStatus RulesJournal::snapshotRead(const QString & path, LayoutRules & rules, quint64 & sequence)
+{
+    QFile file(path);
+    if(! file.open(QIODevice::ReadOnly) || file.size() < snapshotHeaderSize)
+        return SnapshotForeign;
+
+    // parsed from the mapping, without the stream copy
+    auto size = file.size();
+    auto data = file.map(0, size);
+
+    if(! data || 0 != std::memcmp(data, snapshotMagic, sizeof(snapshotMagic)))
+        return SnapshotForeign;
+
+    // our magic: never parsed as the legacy stream
+    auto version = qFromLittleEndian<quint32>(data + 8);
+    if(version < 2 || snapshotVersion < version)
+    {
+        qWarning() << "cache unsupported version:" << version << path;
+        return SnapshotUnsupported;
+    }
+
+    const int entrySize = version < 3 ? 12 : 20;
+
+    auto count = qFromLittleEndian<quint32>(data + 12);
+    auto seq = qFromLittleEndian<quint64>(data + 16);
+    auto ptr = data + snapshotHeaderSize;
+    auto end = data + size;
+
+    // the count not trusted
+    rules.reserve(std::min<qint64>(count, size / entrySize));
+
+    for(quint32 it = 0; it < count; ++it)
+    {
+        if(end - ptr < entrySize)
+            break;
+
+        LayoutRule rule;
+        rule.layout = qFromLittleEndian<qint32>(ptr);
+        rule.state = qFromLittleEndian<qint32>(ptr + 4);
+
+        auto size1 = qFromLittleEndian<quint16>(ptr + 8);
+        auto size2 = qFromLittleEndian<quint16>(ptr + 10);
+
+        // unknown: the age from load
+        rule.lastUsed = 3 <= version ? qFromLittleEndian<qint64>(ptr + 12) : QDateTime::currentSecsSinceEpoch();
+
+        ptr += entrySize;
+
+        if(end - ptr < size1 + size2)
+            break;
+
+        rule.class1 = QString::fromUtf8(reinterpret_cast<const char*>(ptr), size1);
+        rule.class2 = QString::fromUtf8(reinterpret_cast<const char*>(ptr + size1), size2);
+        ptr += size1 + size2;
+
+        rules.insert(rule);
+    }
+
+    if(rules.size() != (int) count)
+        qWarning() << "cache truncated:" << path;
+
+    sequence = seq;
+    return SnapshotLoaded;
+}
+
+bool RulesJournal::snapshotReadLegacy(const QString & path, LayoutRules & rules, quint64 & sequence)
+{
+    QFile file(path);
+    if(! file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream ds(&file);
+
+    int version, counts;
+    ds >> version >> counts;
+
+    for(int cur = 0; cur < counts && ds.status() == QDataStream::Ok; ++cur)
+    {
+        LayoutRule rule;
+        ds >> rule.class1 >> rule.class2 >> rule.layout >> rule.state;
+        rule.lastUsed = QDateTime::currentSecsSinceEpoch();
+
+        rules.insert(rule);
+    }
+
+    // the last journal sequence, from the first journal version
+    quint64 last = 0;
+    ds >> last;
+
+    if(ds.status() == QDataStream::Ok)
+        sequence = last;
+
+    return true;
+}
+
+QByteArray RulesJournal::snapshotData(const LayoutRules & rules, quint64 sequence)
+{
+    QByteArray data(snapshotMagic, sizeof(snapshotMagic));
+    data.reserve(snapshotHeaderSize + rules.size() * 52);
+
+    auto appendInt = [&data](auto val)
+    {
+        char tmp[sizeof(val)];
+        qToLittleEndian(val, tmp);
+        data.append(tmp, sizeof(val));
+    };
+
+    appendInt(snapshotVersion);
+    appendInt(quint32(rules.size()));
+    appendInt(quint64(sequence));
+
+    for(auto & rule : rules)
+    {
+        auto class1 = rule.class1.toUtf8().left(0xFFFF);
+        auto class2 = rule.class2.toUtf8().left(0xFFFF);
+
+        appendInt(qint32(rule.layout));
+        appendInt(qint32(rule.state));
+        appendInt(quint16(class1.size()));
+        appendInt(quint16(class2.size()));
+        appendInt(qint64(rule.lastUsed));
+
+        data.append(class1).append(class2);
+    }
+
+    return data;
+}
+
+RulesJournal::RulesJournal()
+{
+    pool.setMaxThreadCount(1);
+}
+
+RulesJournal::~RulesJournal()
+{
+    pool.waitForDone();
+}
+
+bool RulesJournal::load(const QString & dir, LayoutRules & rules)
+{
+    QDir().mkpath(dir);
+
+    snapshotPath = QDir(dir).absoluteFilePath("cache");
+    journalPath = QDir(dir).absoluteFilePath("cache.journal");
+
+    rules.clear();
+    sequence = 0;
+    records = 0;
+
+    auto status = snapshotRead(snapshotPath, rules, sequence);
+
+    // the newer build files: not replayed, not compacted
+    if(status == SnapshotUnsupported)
+        return false;
+
+    if(status == SnapshotForeign)
+        snapshotReadLegacy(snapshotPath, rules, sequence);
+
+    // rotated journal, the compaction not finished
+    auto snapshot = sequence;
+    sequence = std::max(sequence, replay(journalPath + ".1", rules, snapshot, false));
+    sequence = std::max(sequence, replay(journalPath, rules, snapshot, true));
+
+    journal.setFileName(journalPath);
+    if(! journal.open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        qWarning() << "error open file" << journalPath;
+        return false;
+    }
+
+    return true;
+}
+
+quint64 RulesJournal::replay(const QString & path, LayoutRules & rules, quint64 from, bool truncate)
+{
+    QFile file(path);
+    if(! file.exists() || ! file.open(QIODevice::ReadWrite))
+        return 0;
+
+    auto data = file.readAll();
+    quint64 last = 0;
+    int pos = 0;
+
+    while(pos + journalHeaderSize <= data.size())
+    {
+        auto size = qFromLittleEndian<quint32>(data.constData() + pos);
+        auto crc = qFromLittleEndian<quint16>(data.constData() + pos + 4);
+
+        if(data.size() < pos + journalHeaderSize + (qint64) size)
+            break;
+
+        auto payload = QByteArray::fromRawData(data.constData() + pos + journalHeaderSize, size);
+        if(crc != journalChecksum(payload))
+            break;
+
+        QDataStream ds(payload);
+        ds.setVersion(QDataStream::Qt_5_6);
+
+        quint64 seq;
+        quint8 op;
+        LayoutRule rule;
+
+        ds >> seq >> op >> rule.class1 >> rule.class2 >> rule.layout >> rule.state;
+        if(ds.status() != QDataStream::Ok)
+            break;
+
+        // not in the first records version
+        ds >> rule.lastUsed;
+        if(0 == rule.lastUsed)
+            rule.lastUsed = QDateTime::currentSecsSinceEpoch();
+
+        // applied in snapshot
+        if(from < seq)
+        {
+            if(op == OpPut)
+                rules.insert(rule);
+            else
+            if(op == OpRemove)
+                rules.remove(rule.class1, rule.class2);
+
+            records++;
+        }
+
+        last = std::max(last, seq);
+        pos += journalHeaderSize + size;
+    }
+
+    // torn tail after crash
+    if(pos < data.size())
+    {
+        qWarning() << "journal broken at:" << pos << path;
+
+        if(truncate)
+            file.resize(pos);
+    }
+
+    return last;
+}
+
+void RulesJournal::append(int op, const LayoutRule & rule)
+{
+    if(! journal.isOpen())
+        return;
+
+    QByteArray payload;
+    QDataStream ds(& payload, QIODevice::WriteOnly);
+    ds.setVersion(QDataStream::Qt_5_6);
+
+    ds << quint64(++sequence) << quint8(op) << rule.class1 << rule.class2 << qint32(rule.layout) << qint32(rule.state) << qint64(rule.lastUsed);
+
+    char header[journalHeaderSize];
+    qToLittleEndian<quint32>(payload.size(), header);
+    qToLittleEndian<quint16>(journalChecksum(payload), header + 4);
+
+    // one write, survives the process crash
+    journal.write(QByteArray(header, journalHeaderSize).append(payload));
+    journal.flush();
+
+    records++;
+}
+
+void RulesJournal::put(const LayoutRule & rule)
+{
+    append(OpPut, rule);
+}
+
+void RulesJournal::remove(const QString & class1, const QString & class2)
+{
+    LayoutRule rule;
+
+    rule.class1 = class1;
+    rule.class2 = class2;
+
+    append(OpRemove, rule);
+}
+
+bool RulesJournal::compactNeeded(int rules) const
+{
+    return 256 < records && rules < records;
+}
+
+void RulesJournal::compact(const LayoutRules & rules)
+{
+    if(0 == records || snapshotPath.isEmpty() || ! journal.isOpen())
+        return;
+
+    auto rotated = journalPath + ".1";
+
+    // new changes to the new journal, the previous rotation not finished: kept
+    if(! QFile::exists(rotated))
+    {
+        journal.close();
+
+        if(! QFile::rename(journalPath, rotated))
+            qWarning() << "error rename file" << journalPath;
+
+        journal.open(QIODevice::WriteOnly | QIODevice::Append);
+    }
+
+    records = 0;
+
+    // the rules shared, copied on write
+    pool.start(new RulesTask([path = snapshotPath, rotated, rules, seq = sequence]()
+    {
+        QSaveFile file(path);
+        if(! file.open(QIODevice::WriteOnly))
+        {
+            qWarning() << "error open file" << path;
+            return;
+        }
+
+        file.write(snapshotData(rules, seq));
+
+        // atomic rename, then the rotated journal not needed
+        if(file.commit())
+            QFile::remove(rotated);
+    }));
+}
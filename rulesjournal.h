@@ -0,0 +1,71 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef RULESJOURNAL_H
+#define RULESJOURNAL_H
+
+#include <QFile>
+#include <QString>
+#include <QThreadPool>
+
+#include "layoutrules.h"
+
+// rules cache: binary snapshot (memory mapped on load) and append only journal
+// record: uint32 size, uint16 crc, payload { uint64 sequence, uint8 op, class1, class2, int32 layout, int32 state, int64 lastUsed }
+class RulesJournal
+{
+    QString snapshotPath;
+    QString journalPath;
+    QFile journal;
+    quint64 sequence = 0;
+    int records = 0;
+    QThreadPool pool;
+
+    enum { OpPut = 1, OpRemove = 2 };
+
+    void append(int op, const LayoutRule &);
+
+    static bool snapshotReadLegacy(const QString &, LayoutRules &, quint64 & sequence);
+    quint64 replay(const QString & path, LayoutRules &, quint64 from, bool truncate);
+
+public:
+    // foreign: not the binary snapshot, unsupported: from the newer version
+    enum SnapshotStatus { SnapshotLoaded, SnapshotForeign, SnapshotUnsupported };
+
+    static SnapshotStatus snapshotRead(const QString &, LayoutRules &, quint64 & sequence);
+    static QByteArray snapshotData(const LayoutRules &, quint64 sequence);
+
+    RulesJournal();
+    ~RulesJournal();
+
+    // snapshot and journals replayed, the unsupported snapshot: nothing loaded and saved
+    bool load(const QString & dir, LayoutRules &);
+
+    void put(const LayoutRule &);
+    void remove(const QString & class1, const QString & class2);
+
+    bool compactNeeded(int rules) const;
+    // snapshot written in background, the journal rotated
+    void compact(const LayoutRules &);
+};
+
+#endif // RULESJOURNAL_H
@@ -0,0 +1,318 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <algorithm>
+
+#include <QDebug>
+
+#include "windowrules.h"
+
+QStringList windowStringList(const char* ptr, int len)
+{
+    QStringList res;
+
+    if(ptr && 0 < len)
+    {
+        for(auto & ba : QByteArray(ptr, len - (ptr[len - 1] ? 0 : 1 /* remove last nul */)).split(0))
+            res << QString(ba);
+    }
+
+    return res;
+}
+
+QString windowTitleFormat(QString format, const QString & title, const QString & label)
+{
+    return format.replace(QString("%{title}"), title).replace(QString("%{label}"), label);
+}
+
+/* WindowMatcher */
+void WindowMatcher::add(const QString & pattern)
+{
+    if(! pattern.isEmpty())
+    {
+        patterns << pattern;
+        compiled = false;
+    }
+}
+
+void WindowMatcher::clear(void)
+{
+    patterns.clear();
+    compiled = false;
+}
+
+bool WindowMatcher::isEmpty(void) const
+{
+    return patterns.isEmpty();
+}
+
+void WindowMatcher::compile(void)
+{
+    QStringList alternatives;
+
+    exact.clear();
+    regexes.clear();
+    results.clear();
+
+    for(auto & pattern : patterns)
+    {
+        if(pattern.startsWith("re:"))
+        {
+            QRegularExpression rx(pattern.mid(3), QRegularExpression::CaseInsensitiveOption);
+            if(! rx.isValid())
+            {
+                qWarning() << "invalid regex:" << pattern << rx.errorString();
+                continue;
+            }
+
+            rx.optimize();
+            regexes.append(rx);
+        }
+        else
+        if(pattern.contains('*') || pattern.contains('?') || pattern.contains('['))
+        {
+            // anchored
+            alternatives << QRegularExpression::wildcardToRegularExpression(pattern);
+        }
+        else
+        {
+            exact << pattern.toCaseFolded();
+        }
+    }
+
+    combined = QRegularExpression(alternatives.join('|'), QRegularExpression::CaseInsensitiveOption);
+
+    if(! alternatives.isEmpty())
+        combined.optimize();
+
+    compiled = true;
+}
+
+bool WindowMatcher::match(const QString & name)
+{
+    if(! compiled)
+        compile();
+
+    auto it = results.find(name);
+    if(it != results.end())
+        return it.value();
+
+    bool res = exact.contains(name.toCaseFolded()) ||
+                (! combined.pattern().isEmpty() && combined.match(name).hasMatch());
+
+    for(int ii = 0; ! res && ii < regexes.size(); ++ii)
+        res = regexes.at(ii).match(name).hasMatch();
+
+    // the random class names
+    if(4096 < results.size())
+        results.clear();
+
+    results.insert(name, res);
+    return res;
+}
+
+bool WindowMatcher::match(const QStringList & classes)
+{
+    for(auto & name : classes)
+        if(match(name))
+            return true;
+
+    return false;
+}
+
+/* TitleMatcher */
+bool TitleMatcher::add(const QString & pattern, int layout, int state)
+{
+    TitleRule rule;
+
+    rule.regex = QRegularExpression(pattern, QRegularExpression::CaseInsensitiveOption);
+    rule.layout = layout;
+    rule.state = state;
+
+    if(pattern.isEmpty() || ! rule.regex.isValid())
+    {
+        qWarning() << "invalid title regex:" << pattern << rule.regex.errorString();
+        return false;
+    }
+
+    rule.regex.optimize();
+    rules.append(rule);
+    memo.clear();
+
+    return true;
+}
+
+void TitleMatcher::clear(void)
+{
+    rules.clear();
+    memo.clear();
+}
+
+bool TitleMatcher::isEmpty(void) const
+{
+    return rules.isEmpty();
+}
+
+int TitleMatcher::match(quint32 win, const QString & title)
+{
+    if(rules.isEmpty())
+        return -1;
+
+    auto hash = static_cast<uint>(qHash(title));
+    auto it = memo.find(win);
+
+    if(it != memo.end() && it->hash == hash)
+        return it->index;
+
+    int index = -1;
+    for(int ii = 0; ii < rules.size(); ++ii)
+    {
+        if(rules.at(ii).regex.match(title).hasMatch())
+        {
+            index = ii;
+            break;
+        }
+    }
+
+    // without destroy notify for the inactive windows
+    if(it == memo.end() && 1024 < memo.size())
+        memo.clear();
+
+    memo.insert(win, TitleMemo{ hash, index });
+    return index;
+}
+
+const TitleRule & TitleMatcher::at(int index) const
+{
+    return rules.at(index);
+}
+
+void TitleMatcher::remove(quint32 win)
+{
+    memo.remove(win);
+}
+
+/* WindowLayouts */
+quint32 WindowLayouts::hash(quint32 win)
+{
+    // the window ids are sequential with the client base
+    win ^= win >> 16;
+    win *= 0x45d9f3b;
+    win ^= win >> 16;
+    return win;
+}
+
+int WindowLayouts::position(quint32 win) const
+{
+    if(slots.isEmpty() || 0 == win)
+        return -1;
+
+    const int mask = slots.size() - 1;
+
+    for(int pos = hash(win) & mask; slots.at(pos).win; pos = (pos + 1) & mask)
+    {
+        if(slots.at(pos).win == win)
+            return pos;
+    }
+
+    return -1;
+}
+
+void WindowLayouts::rehash(int size)
+{
+    QVector<Slot> old(size);
+    old.swap(slots);
+    count = 0;
+
+    for(auto & slot : old)
+    {
+        if(slot.win)
+            insert(slot.win, slot.group);
+    }
+}
+
+int WindowLayouts::find(quint32 win) const
+{
+    int pos = position(win);
+    return 0 <= pos ? slots.at(pos).group : -1;
+}
+
+void WindowLayouts::insert(quint32 win, int group)
+{
+    if(0 == win)
+        return;
+
+    if(slots.size() < (count + 1) * 2)
+        rehash(std::max(64, slots.size() * 2));
+
+    const int mask = slots.size() - 1;
+    int pos = hash(win) & mask;
+
+    while(slots.at(pos).win && slots.at(pos).win != win)
+        pos = (pos + 1) & mask;
+
+    if(0 == slots.at(pos).win)
+        count++;
+
+    slots[pos].win = win;
+    slots[pos].group = group;
+}
+
+bool WindowLayouts::remove(quint32 win)
+{
+    int pos = position(win);
+    if(pos < 0)
+        return false;
+
+    // backward shift, without tombstones
+    const int mask = slots.size() - 1;
+    int next = (pos + 1) & mask;
+
+    while(slots.at(next).win)
+    {
+        int home = hash(slots.at(next).win) & mask;
+
+        if(((next - pos) & mask) <= ((next - home) & mask))
+        {
+            slots[pos] = slots.at(next);
+            pos = next;
+        }
+
+        next = (next + 1) & mask;
+    }
+
+    slots[pos] = Slot();
+    count--;
+
+    return true;
+}
+
+void WindowLayouts::clear(void)
+{
+    slots.clear();
+    count = 0;
+}
+
+int WindowLayouts::size(void) const
+{
+    return count;
+}
@@ -0,0 +1,123 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WINDOWRULES_H
+#define WINDOWRULES_H
+
+#include <QSet>
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include <QRegularExpression>
+
+// null separated property: WM_CLASS, _XKB_RULES_NAMES
+QStringList windowStringList(const char* ptr, int len);
+
+// "%{title} [%{label}]"
+QString windowTitleFormat(QString format, const QString & title, const QString & label);
+
+// WM_CLASS patterns, case insensitive: "exact", "glob*" anchored (the whole name),
+// "re:regex" unanchored (use ^...$ for the whole name)
+class WindowMatcher
+{
+    QStringList patterns;
+    // exact names, case folded
+    QSet<QString> exact;
+    // globs: one expression, without the capture groups
+    QRegularExpression combined;
+    // regex: separately, the backreferences and the groups kept
+    QVector<QRegularExpression> regexes;
+    bool compiled = false;
+    // per class, positive and negative
+    mutable QHash<QString, bool> results;
+
+    void compile(void);
+
+public:
+    void add(const QString & pattern);
+    void clear(void);
+    bool isEmpty(void) const;
+
+    bool match(const QString & name);
+    // instance or class
+    bool match(const QStringList & classes);
+};
+
+struct TitleRule
+{
+    QRegularExpression regex;
+    int layout = 0;
+    int state = 0;
+};
+
+// title rules, the first match: memoized per window and title hash
+class TitleMatcher
+{
+    struct TitleMemo
+    {
+        uint hash = 0;
+        int index = -1;
+    };
+
+    QVector<TitleRule> rules;
+    QHash<quint32, TitleMemo> memo;
+
+public:
+    bool add(const QString & pattern, int layout, int state);
+    void clear(void);
+    bool isEmpty(void) const;
+
+    // rule index or -1
+    int match(quint32 win, const QString & title);
+    const TitleRule & at(int index) const;
+    void remove(quint32 win);
+};
+
+// window id to xkb group: open addressing, linear probe
+class WindowLayouts
+{
+    struct Slot
+    {
+        quint32 win = 0;
+        qint32 group = -1;
+    };
+
+    // power of two, half filled at most
+    QVector<Slot> slots;
+    int count = 0;
+
+    static quint32 hash(quint32 win);
+    int position(quint32 win) const;
+    void rehash(int size);
+
+public:
+    // group or -1
+    int find(quint32 win) const;
+    void insert(quint32 win, int group);
+    bool remove(quint32 win);
+
+    void clear(void);
+    int size(void) const;
+};
+
+#endif // WINDOWRULES_H
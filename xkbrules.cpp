@@ -0,0 +1,300 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+#include <QRegularExpression>
+
+#include <algorithm>
+
+#include "xkbrules.h"
+
+QString XkbRules::rulesPath(const QString & rules)
+{
+    if(rules.contains('/'))
+        return rules;
+
+    auto root = qEnvironmentVariable("XKB_CONFIG_ROOT", "/usr/share/X11/xkb");
+    return QDir(root).filePath(QString("rules/%1").arg(rules.isEmpty() ? QString("evdev") : rules));
+}
+
+static const QStringList mlvoNames = { "model", "layout", "variant", "option" };
+static const QStringList kccgstNames = { "keycodes", "types", "compat", "symbols", "geometry" };
+
+bool XkbRules::load(const QString & path)
+{
+    QFile file(path);
+    if(! file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "error open file" << path;
+        return false;
+    }
+
+    static const QRegularExpression rxKey("^(\\w+)(?:\\[(\\d+)\\])?$");
+    static const QRegularExpression rxSpaces("\\s+");
+
+    groups.clear();
+    mappings.clear();
+
+    Mapping* mapping = nullptr;
+    auto content = QString::fromUtf8(file.readAll()).replace("\\\n", " ");
+
+    for(auto line : content.split('\n'))
+    {
+        auto comment = line.indexOf("//");
+        if(0 <= comment)
+            line.truncate(comment);
+
+        line = line.trimmed();
+
+        auto pos = line.indexOf('=');
+
+        // ! include: not supported, the partial rules give the wrong components
+        if(pos < 0 && line.startsWith('!'))
+        {
+            qWarning() << "unknown rules header:" << line << path;
+            mappings.clear();
+            return false;
+        }
+
+        if(pos < 0)
+            continue;
+
+        auto left = line.left(pos).split(rxSpaces);
+        auto right = line.mid(pos + 1).split(rxSpaces);
+        left.removeAll(QString());
+        right.removeAll(QString());
+
+        if(line.startsWith('!'))
+        {
+            left.front().remove(0, 1);
+            left.removeAll(QString());
+            mapping = nullptr;
+
+            if(left.isEmpty())
+                continue;
+
+            // ! $group = val1 val2
+            if(left.front().startsWith('$'))
+            {
+                groups.insert(left.front(), right);
+                continue;
+            }
+
+            // ! model layout[1] = symbols
+            Mapping map;
+
+            for(auto & key : left)
+            {
+                // layout[first], layout[later]: the newer syntax not matched
+                auto match = rxKey.match(key);
+                if(! match.hasMatch() || ! mlvoNames.contains(match.captured(1)))
+                    break;
+
+                map.mlvo << qMakePair(match.captured(1), match.captured(2).isEmpty() ? -1 : match.captured(2).toInt() - 1);
+            }
+
+            bool known = std::all_of(right.begin(), right.end(), [](auto & str){ return kccgstNames.contains(str); });
+
+            // all or nothing: setxkbmap spawned
+            if(map.mlvo.size() != left.size() || right.isEmpty() || ! known)
+            {
+                qWarning() << "unknown rules mapping:" << line << path;
+                mappings.clear();
+                return false;
+            }
+
+            map.kccgst = right;
+            mappings << map;
+            mapping = & mappings.back();
+        }
+        else
+        if(mapping && left.size() == mapping->mlvo.size() && right.size() == mapping->kccgst.size())
+        {
+            mapping->rules << qMakePair(left, right);
+        }
+    }
+
+    return ! mappings.isEmpty();
+}
+
+// %m, %l, %v, %l[1], and prefixed: %+l, %_v, %(v[2])
+static QString expandValue(const QString & value, const QString & model, const QStringList & layouts, const QStringList & variants)
+{
+    QString res;
+
+    for(int pos = 0; pos < value.size(); ++pos)
+    {
+        if(value.at(pos) != '%')
+        {
+            res.append(value.at(pos));
+            continue;
+        }
+
+        QString prefix, suffix;
+
+        if(++pos < value.size() && QString("+|_-").contains(value.at(pos)))
+            prefix = value.at(pos++);
+        else
+        if(pos < value.size() && value.at(pos) == '(')
+        {
+            prefix = "(";
+            suffix = ")";
+            pos++;
+        }
+
+        if(pos >= value.size())
+            break;
+
+        auto type = value.at(pos);
+        int index = -1;
+
+        if(pos + 1 < value.size() && value.at(pos + 1) == '[')
+        {
+            auto end = value.indexOf(']', pos);
+            if(end < 0)
+                break;
+
+            index = value.mid(pos + 2, end - pos - 2).toInt() - 1;
+            pos = end;
+        }
+
+        if(! suffix.isEmpty())
+            pos++;
+
+        QString str;
+
+        if(type == 'm')
+            str = model;
+        else
+        if(type == 'l')
+            str = 0 <= index ? layouts.value(index) : layouts.join(",");
+        else
+        if(type == 'v')
+            str = 0 <= index ? variants.value(index) : variants.join(",");
+
+        if(! str.isEmpty())
+            res.append(prefix).append(str).append(suffix);
+    }
+
+    return res;
+}
+
+XkbComponents XkbRules::resolve(const QString & model, const QString & layout, const QString & variant, const QString & options) const
+{
+    auto layouts = layout.split(',');
+    auto variants = variant.split(',');
+    auto opts = options.split(',');
+    opts.removeAll(QString());
+
+    while(variants.size() < layouts.size())
+        variants << QString();
+
+    QHash<QString, QString> res;
+
+    for(auto & mapping : mappings)
+    {
+        bool skip = false;
+        bool option = false;
+
+        for(auto & key : mapping.mlvo)
+        {
+            // layout: single layout only, layout[N]: multiple layouts only
+            if(key.first == "layout" || key.first == "variant")
+            {
+                if(key.second < 0 ? 1 < layouts.size() : (1 == layouts.size() || key.second >= layouts.size()))
+                    skip = true;
+            }
+            else
+            if(key.first == "option")
+                option = true;
+        }
+
+        if(skip)
+            continue;
+
+        for(auto & rule : mapping.rules)
+        {
+            bool match = true;
+
+            for(int it = 0; it < mapping.mlvo.size() && match; ++it)
+            {
+                auto & key = mapping.mlvo.at(it);
+                auto & val = rule.first.at(it);
+                auto index = std::max(0, key.second);
+                QStringList cand;
+
+                if(key.first == "model")
+                    cand << model;
+                else
+                if(key.first == "layout")
+                    cand << layouts.value(index);
+                else
+                if(key.first == "variant")
+                    cand << variants.value(index);
+                else
+                if(key.first == "option")
+                    cand = opts;
+
+                // any, not empty
+                if(val == "*")
+                    match = key.first != "option" && ! cand.value(0).isEmpty();
+                else
+                if(val.startsWith('$'))
+                    match = std::any_of(cand.begin(), cand.end(), [&](auto & str){ return groups.value(val).contains(str); });
+                else
+                    match = cand.contains(val);
+            }
+
+            if(! match)
+                continue;
+
+            for(int it = 0; it < mapping.kccgst.size(); ++it)
+            {
+                auto & comp = res[mapping.kccgst.at(it)];
+                auto str = expandValue(rule.second.at(it), model, layouts, variants);
+
+                // the first value, then the appended only
+                if(comp.isEmpty())
+                    comp = str;
+                else
+                if(str.startsWith('+') || str.startsWith('|'))
+                    comp.append(str);
+            }
+
+            // options: all matched rules
+            if(! option)
+                break;
+        }
+    }
+
+    XkbComponents comps;
+
+    comps.keycodes = res.value("keycodes");
+    comps.types = res.value("types");
+    comps.compat = res.value("compat");
+    comps.symbols = res.value("symbols");
+    comps.geometry = res.value("geometry");
+
+    return comps;
+}
@@ -0,0 +1,65 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef XKBRULES_H
+#define XKBRULES_H
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+
+// keycodes, types, compat, symbols, geometry
+struct XkbComponents
+{
+    QString keycodes;
+    QString types;
+    QString compat;
+    QString symbols;
+    QString geometry;
+};
+
+// rules file: model, layout, variant, options to the components, as setxkbmap
+class XkbRules
+{
+    struct Mapping
+    {
+        // mlvo name, layout index or -1
+        QList<QPair<QString, int>> mlvo;
+        QStringList kccgst;
+        QList<QPair<QStringList, QStringList>> rules;
+    };
+
+    QHash<QString, QStringList> groups;
+    QList<Mapping> mappings;
+
+public:
+    // rules name or path
+    static QString rulesPath(const QString & rules);
+
+    // false: the unknown headers, the rules not used
+    bool load(const QString & path);
+    XkbComponents resolve(const QString & model, const QString & layout, const QString & variant, const QString & options) const;
+};
+
+#endif // XKBRULES_H
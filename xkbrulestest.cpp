@@ -0,0 +1,156 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QDebug>
+#include <QProcess>
+#include <QCoreApplication>
+#include <QRegularExpression>
+
+#include "xkbrules.h"
+
+struct XkbRulesCase
+{
+    const char* model;
+    const char* layout;
+    const char* variant;
+    const char* options;
+};
+
+static const XkbRulesCase rulesCases[] = {
+    { "pc105", "us", "", "" },
+    { "pc105", "us,de", "", "" },
+    { "pc105", "us,ru", ",phonetic", "grp:alt_shift_toggle" },
+    { "pc105", "de", "nodeadkeys", "ctrl:nocaps,compose:ralt" },
+    { "pc104", "fr,us,ru", "", "grp:caps_toggle,grp_led:scroll" },
+    { "thinkpad60", "gb", "", "" },
+    { "pc105", "us,de,fr,ru", ",,,", "grp:win_space_toggle" },
+};
+
+// setxkbmap -print: xkb_symbols { include "pc+us+inet(evdev)" };
+static XkbComponents setxkbmapPrint(const QString & setxkbmap, const XkbRulesCase & test, QProcessEnvironment env)
+{
+    QStringList args = QStringList() << "-print" << "-rules" << "evdev" << "-model" << test.model <<
+                        "-layout" << test.layout << "-variant" << test.variant << "-option" << "";
+
+    if(*test.options)
+        args << "-option" << test.options;
+
+    QProcess proc;
+    proc.setProcessEnvironment(env);
+    proc.start(setxkbmap, args);
+
+    XkbComponents comps;
+
+    if(! proc.waitForFinished(10000) || proc.exitCode() != 0)
+    {
+        qWarning() << "setxkbmap failed:" << args << proc.readAllStandardError();
+        return comps;
+    }
+
+    static const QRegularExpression rx("xkb_(keycodes|types|compat|symbols|geometry)\\s*\\{\\s*include\\s*\"([^\"]*)\"");
+    auto it = rx.globalMatch(QString::fromUtf8(proc.readAllStandardOutput()));
+
+    while(it.hasNext())
+    {
+        auto match = it.next();
+        auto type = match.captured(1);
+
+        if(type == "keycodes")
+            comps.keycodes = match.captured(2);
+        else
+        if(type == "types")
+            comps.types = match.captured(2);
+        else
+        if(type == "compat")
+            comps.compat = match.captured(2);
+        else
+        if(type == "symbols")
+            comps.symbols = match.captured(2);
+        else
+            comps.geometry = match.captured(2);
+    }
+
+    return comps;
+}
+
+// XkbRules::resolve against setxkbmap: qxkb5-xkbrulestest <setxkbmap> [Xvfb]
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    auto args = app.arguments();
+
+    if(args.size() < 2)
+    {
+        qWarning() << "usage:" << args.front() << "<setxkbmap> [Xvfb]";
+        return 1;
+    }
+
+    XkbRules rules;
+    int failed = 0;
+
+    // the newer syntax: applied by setxkbmap, not tested
+    if(! rules.load(XkbRules::rulesPath("evdev")))
+    {
+        qWarning() << "rules not supported, skipped:" << XkbRules::rulesPath("evdev");
+        return 0;
+    }
+
+    auto env = QProcessEnvironment::systemEnvironment();
+    QProcess xvfb;
+
+    // setxkbmap -print opens the display
+    if(! env.contains("DISPLAY") && 2 < args.size())
+    {
+        xvfb.start(args.at(2), QStringList() << "-displayfd" << "1" << "-nolisten" << "tcp");
+
+        if(! xvfb.waitForReadyRead(10000))
+        {
+            qWarning() << "Xvfb start failed:" << args.at(2);
+            return 1;
+        }
+
+        env.insert("DISPLAY", QString(":%1").arg(QString(xvfb.readLine().trimmed())));
+    }
+
+    for(auto & test : rulesCases)
+    {
+        auto comps1 = rules.resolve(test.model, test.layout, test.variant, test.options);
+        auto comps2 = setxkbmapPrint(args.at(1), test, env);
+
+        if(comps1.keycodes != comps2.keycodes || comps1.types != comps2.types || comps1.compat != comps2.compat ||
+            comps1.symbols != comps2.symbols || comps1.geometry != comps2.geometry)
+        {
+            qWarning() << "mismatch:" << test.model << test.layout << test.variant << test.options;
+            qWarning() << "  resolve:" << comps1.keycodes << comps1.types << comps1.compat << comps1.symbols << comps1.geometry;
+            qWarning() << "  setxkbmap:" << comps2.keycodes << comps2.types << comps2.compat << comps2.symbols << comps2.geometry;
+            failed++;
+        }
+    }
+
+    if(xvfb.state() != QProcess::NotRunning)
+    {
+        xvfb.terminate();
+        xvfb.waitForFinished(3000);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,507 @@
+/***************************************************************************
+ *   Copyright © 2022 by Andrey Afletdinov <public.irkutsk@gmail.com>      *
+ *                                                                         *
+ *   Part of the QXKB5                                                     *
+ *   https://github.com/AndreyBarmaley/qxkb5                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+#include <QThread>
+#include <QProcess>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QTemporaryDir>
+#include <QCoreApplication>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <numeric>
+#include <cstring>
+#include <algorithm>
+#include <poll.h>
+
+#include "xcb/xcb.h"
+#include "xcb/xkb.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// the EWMH stand-in: qxkb5 reads the root _NET_ACTIVE_WINDOW only
+struct XvfbBench
+{
+    std::unique_ptr<xcb_connection_t, decltype(xcb_disconnect)*> conn{nullptr, xcb_disconnect};
+    xcb_window_t root = XCB_WINDOW_NONE;
+    uint8_t xkbFirstEvent = 0;
+    xcb_atom_t atomActiveWindow = XCB_ATOM_NONE;
+    xcb_atom_t atomNetWmName = XCB_ATOM_NONE;
+    xcb_atom_t atomUtf8String = XCB_ATOM_NONE;
+    xcb_atom_t atomStats = XCB_ATOM_NONE;
+    uint32_t statsSerial = 0;
+
+    bool connect(const QString & display);
+    xcb_atom_t getAtom(const char*) const;
+    xcb_window_t createWindow(int id, int classId) const;
+    void setActiveWindow(xcb_window_t) const;
+    void lockGroup(int) const;
+    int groupsCount(void) const;
+    int getGroup(void) const;
+    // the group change and the title write on win, -1: not waited
+    bool waitEvents(xcb_window_t win, int group, Clock::time_point & layout, Clock::time_point & title, int ms) const;
+    void drainEvents(int ms) const;
+    QJsonObject stats(const QString & path, int ms);
+};
+
+bool XvfbBench::connect(const QString & display)
+{
+    conn.reset(xcb_connect(display.toLocal8Bit().constData(), nullptr));
+
+    if(xcb_connection_has_error(conn.get()))
+    {
+        qWarning() << "xcb_connect failed:" << display;
+        return false;
+    }
+
+    auto setup = xcb_get_setup(conn.get());
+    auto screen = xcb_setup_roots_iterator(setup).data;
+    if(! screen)
+        return false;
+
+    root = screen->root;
+
+    auto xkbext = xcb_get_extension_data(conn.get(), & xcb_xkb_id);
+    if(! xkbext || ! xkbext->present)
+    {
+        qWarning() << "xkb extension not found";
+        return false;
+    }
+
+    xkbFirstEvent = xkbext->first_event;
+
+    std::unique_ptr<xcb_xkb_use_extension_reply_t, void(*)(void*)> reply(
+        xcb_xkb_use_extension_reply(conn.get(), xcb_xkb_use_extension(conn.get(), XCB_XKB_MAJOR_VERSION, XCB_XKB_MINOR_VERSION), nullptr), std::free);
+    if(! reply || ! reply->supported)
+    {
+        qWarning() << "xcb_xkb_use_extension failed";
+        return false;
+    }
+
+    const uint16_t events = XCB_XKB_EVENT_TYPE_STATE_NOTIFY;
+    xcb_xkb_select_events(conn.get(), XCB_XKB_ID_USE_CORE_KBD, events, 0, events, 0, 0, nullptr);
+
+    atomActiveWindow = getAtom("_NET_ACTIVE_WINDOW");
+    atomNetWmName = getAtom("_NET_WM_NAME");
+    atomUtf8String = getAtom("UTF8_STRING");
+    atomStats = getAtom("_QXKB5_STATS");
+
+    // _NET_SUPPORTED: the active window only
+    auto atomSupported = getAtom("_NET_SUPPORTED");
+    xcb_change_property(conn.get(), XCB_PROP_MODE_REPLACE, root, atomSupported, XCB_ATOM_ATOM, 32, 1, & atomActiveWindow);
+    xcb_flush(conn.get());
+
+    return true;
+}
+
+xcb_atom_t XvfbBench::getAtom(const char* name) const
+{
+    std::unique_ptr<xcb_intern_atom_reply_t, void(*)(void*)> reply(
+        xcb_intern_atom_reply(conn.get(), xcb_intern_atom(conn.get(), 0, std::strlen(name), name), nullptr), std::free);
+
+    return reply ? reply->atom : XCB_ATOM_NONE;
+}
+
+xcb_window_t XvfbBench::createWindow(int id, int classId) const
+{
+    xcb_window_t win = xcb_generate_id(conn.get());
+    const uint32_t values[] = { XCB_EVENT_MASK_PROPERTY_CHANGE };
+
+    xcb_create_window(conn.get(), XCB_COPY_FROM_PARENT, win, root, 0, 0, 100, 100, 0,
+                        XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_COPY_FROM_PARENT, XCB_CW_EVENT_MASK, values);
+
+    // instance, class: null separated
+    auto wmClass = QString("bench%1").arg(classId).toLatin1();
+    wmClass.append('\0').append(QString("Bench%1").arg(classId).toLatin1()).append('\0');
+    xcb_change_property(conn.get(), XCB_PROP_MODE_REPLACE, win, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8, wmClass.size(), wmClass.constData());
+
+    auto title = QString("bench window %1").arg(id).toUtf8();
+    xcb_change_property(conn.get(), XCB_PROP_MODE_REPLACE, win, atomNetWmName, atomUtf8String, 8, title.size(), title.constData());
+
+    xcb_map_window(conn.get(), win);
+    xcb_flush(conn.get());
+
+    return win;
+}
+
+void XvfbBench::setActiveWindow(xcb_window_t win) const
+{
+    xcb_change_property(conn.get(), XCB_PROP_MODE_REPLACE, root, atomActiveWindow, XCB_ATOM_WINDOW, 32, 1, & win);
+    xcb_flush(conn.get());
+}
+
+void XvfbBench::lockGroup(int group) const
+{
+    xcb_xkb_latch_lock_state(conn.get(), XCB_XKB_ID_USE_CORE_KBD, 0, 0, 1, group, 0, 0, 0);
+    xcb_flush(conn.get());
+}
+
+int XvfbBench::groupsCount(void) const
+{
+    std::unique_ptr<xcb_xkb_get_names_reply_t, void(*)(void*)> reply(
+        xcb_xkb_get_names_reply(conn.get(), xcb_xkb_get_names(conn.get(), XCB_XKB_ID_USE_CORE_KBD, XCB_XKB_NAME_DETAIL_GROUP_NAMES), nullptr), std::free);
+
+    return reply ? __builtin_popcount(reply->groupNames) : 0;
+}
+
+int XvfbBench::getGroup(void) const
+{
+    std::unique_ptr<xcb_xkb_get_state_reply_t, void(*)(void*)> reply(
+        xcb_xkb_get_state_reply(conn.get(), xcb_xkb_get_state(conn.get(), XCB_XKB_ID_USE_CORE_KBD), nullptr), std::free);
+
+    return reply ? reply->group : -1;
+}
+
+bool XvfbBench::waitEvents(xcb_window_t win, int group, Clock::time_point & layout, Clock::time_point & title, int ms) const
+{
+    auto deadline = Clock::now() + std::chrono::milliseconds(ms);
+    bool layoutDone = group < 0;
+    bool titleDone = win == XCB_WINDOW_NONE;
+
+    while(! layoutDone || ! titleDone)
+    {
+        while(auto ev = xcb_poll_for_event(conn.get()))
+        {
+            auto now = Clock::now();
+            auto type = ev->response_type & ~0x80;
+
+            if(type == xkbFirstEvent && ev->pad0 == XCB_XKB_STATE_NOTIFY)
+            {
+                auto sn = reinterpret_cast<xcb_xkb_state_notify_event_t*>(ev);
+                if(! layoutDone && sn->group == group)
+                {
+                    layout = now;
+                    layoutDone = true;
+                }
+            }
+            else
+            if(type == XCB_PROPERTY_NOTIFY)
+            {
+                auto pn = reinterpret_cast<xcb_property_notify_event_t*>(ev);
+                if(! titleDone && pn->window == win && pn->atom == atomNetWmName)
+                {
+                    title = now;
+                    titleDone = true;
+                }
+            }
+
+            std::free(ev);
+        }
+
+        if(layoutDone && titleDone)
+            break;
+
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        if(timeout <= 0 || xcb_connection_has_error(conn.get()))
+            break;
+
+        pollfd fds = { xcb_get_file_descriptor(conn.get()), POLLIN, 0 };
+        poll(& fds, 1, timeout);
+    }
+
+    return layoutDone && titleDone;
+}
+
+void XvfbBench::drainEvents(int ms) const
+{
+    auto deadline = Clock::now() + std::chrono::milliseconds(ms);
+
+    while(! xcb_connection_has_error(conn.get()))
+    {
+        while(auto ev = xcb_poll_for_event(conn.get()))
+            std::free(ev);
+
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        if(timeout <= 0)
+            break;
+
+        pollfd fds = { xcb_get_file_descriptor(conn.get()), POLLIN, 0 };
+        poll(& fds, 1, timeout);
+    }
+}
+
+QJsonObject XvfbBench::stats(const QString & path, int ms)
+{
+    QFile::remove(path);
+
+    statsSerial++;
+    xcb_change_property(conn.get(), XCB_PROP_MODE_REPLACE, root, atomStats, XCB_ATOM_CARDINAL, 32, 1, & statsSerial);
+    xcb_flush(conn.get());
+
+    auto deadline = Clock::now() + std::chrono::milliseconds(ms);
+
+    while(! QFile::exists(path))
+    {
+        if(deadline < Clock::now())
+        {
+            qWarning() << "stats timeout:" << path;
+            return QJsonObject();
+        }
+
+        drainEvents(10);
+    }
+
+    QFile file(path);
+    if(! file.open(QIODevice::ReadOnly))
+        return QJsonObject();
+
+    return QJsonDocument::fromJson(file.readAll()).object();
+}
+
+// all threads: voluntary and involuntary
+static qint64 processSwitches(qint64 pid)
+{
+    qint64 res = 0;
+    QDir dir(QString("/proc/%1/task").arg(pid));
+
+    for(auto & task : dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+    {
+        QFile file(dir.absoluteFilePath(task + "/status"));
+        if(! file.open(QIODevice::ReadOnly))
+            continue;
+
+        for(auto & line : file.readAll().split('\n'))
+        {
+            if(line.startsWith("voluntary_ctxt_switches:") || line.startsWith("nonvoluntary_ctxt_switches:"))
+                res += line.mid(line.indexOf(':') + 1).trimmed().toLongLong();
+        }
+    }
+
+    return res;
+}
+
+// microseconds
+static QJsonObject latencyJson(std::vector<double> vals)
+{
+    QJsonObject jo;
+
+    if(vals.empty())
+        return jo;
+
+    std::sort(vals.begin(), vals.end());
+
+    jo.insert("min", vals.front());
+    jo.insert("median", vals[vals.size() / 2]);
+    jo.insert("p95", vals[std::min(vals.size() - 1, vals.size() * 95 / 100)]);
+    jo.insert("max", vals.back());
+    jo.insert("mean", std::accumulate(vals.begin(), vals.end(), 0.0) / vals.size());
+
+    return jo;
+}
+
+static double jsonDelta(const QJsonObject & jo1, const QJsonObject & jo2, const char* key, double div)
+{
+    return 0 < div ? (jo2.value(key).toDouble() - jo1.value(key).toDouble()) / div : 0;
+}
+
+static void processStop(QProcess & proc)
+{
+    if(proc.state() == QProcess::NotRunning)
+        return;
+
+    proc.terminate();
+    if(! proc.waitForFinished(3000))
+    {
+        proc.kill();
+        proc.waitForFinished(1000);
+    }
+}
+
+// focus change to layout switch and title write: qxkb5-xvfbbench <Xvfb> <qxkb5> <output.json> [iterations]
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    auto args = app.arguments();
+
+    if(args.size() < 4)
+    {
+        qWarning() << "usage:" << args.front() << "<Xvfb> <qxkb5> <output.json> [iterations]";
+        return 1;
+    }
+
+    const int iterations = std::max(1, args.value(4, "200").toInt());
+    const int windowsCount = 8;
+    const int idleSeconds = 5;
+
+    QTemporaryDir tmp;
+    if(! tmp.isValid())
+        return 1;
+
+    // display number from -displayfd
+    QProcess xvfb;
+    xvfb.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    xvfb.start(args.at(1), QStringList() << "-displayfd" << "1" << "-nolisten" << "tcp" << "-screen" << "0" << "640x480x24");
+
+    if(! xvfb.waitForReadyRead(10000))
+    {
+        qWarning() << "Xvfb start failed:" << args.at(1);
+        processStop(xvfb);
+        return 1;
+    }
+
+    auto display = QString(":%1").arg(QString(xvfb.readLine().trimmed()));
+    XvfbBench bench;
+
+    if(! bench.connect(display))
+    {
+        processStop(xvfb);
+        return 1;
+    }
+
+    // two classes, alternated: the layout changes on every focus change
+    std::vector<xcb_window_t> windows;
+    for(int id = 0; id < windowsCount; ++id)
+        windows.push_back(bench.createWindow(id, id % 2));
+
+    QJsonObject config;
+    config.insert("startup:cmd", "setxkbmap -layout us,de");
+    config.insert("title:change", true);
+    config.insert("title:format", "%{title} [%{label}]");
+
+    auto configPath = tmp.filePath("qxkb5.json");
+    QFile configFile(configPath);
+    if(! configFile.open(QIODevice::WriteOnly))
+        return 1;
+
+    configFile.write(QJsonDocument(config).toJson());
+    configFile.close();
+
+    // isolated: lock, cache and local config in the temporary home
+    auto statsPath = tmp.filePath("stats.json");
+    auto env = QProcessEnvironment::systemEnvironment();
+
+    env.insert("DISPLAY", display);
+    env.insert("HOME", tmp.path());
+    env.insert("XDG_CONFIG_HOME", tmp.filePath("config"));
+    env.insert("XDG_DATA_HOME", tmp.filePath("data"));
+    env.insert("XDG_CACHE_HOME", tmp.filePath("cache"));
+    env.insert("QT_QPA_PLATFORM", "xcb");
+    env.insert("QXKB5_STATS", statsPath);
+
+    QProcess qxkb5;
+    qxkb5.setProcessEnvironment(env);
+    qxkb5.setProcessChannelMode(QProcess::ForwardedChannels);
+    qxkb5.start(args.at(2), QStringList() << "--config" << configPath);
+
+    // ready: the startup layouts applied
+    auto deadline = Clock::now() + std::chrono::seconds(15);
+    while(bench.groupsCount() < 2)
+    {
+        if(deadline < Clock::now() || qxkb5.state() == QProcess::NotRunning)
+        {
+            qWarning() << "qxkb5 not ready, the startup layouts not applied";
+            processStop(qxkb5);
+            processStop(xvfb);
+            return 1;
+        }
+
+        bench.drainEvents(50);
+    }
+
+    // learn the class rules: bench0 - group 0, bench1 - group 1
+    Clock::time_point layout, title;
+    for(int id = 0; id < windowsCount; ++id)
+    {
+        bench.setActiveWindow(windows[id]);
+        bench.waitEvents(windows[id], -1, layout, title, 2000);
+
+        if(bench.getGroup() != id % 2)
+        {
+            bench.lockGroup(id % 2);
+            bench.waitEvents(XCB_WINDOW_NONE, id % 2, layout, title, 2000);
+        }
+    }
+
+    bench.drainEvents(300);
+
+    auto stats0 = bench.stats(statsPath, 2000);
+    auto switches0 = processSwitches(qxkb5.processId());
+
+    std::vector<double> layoutLatency, titleLatency;
+    int timeouts = 0;
+
+    for(int it = 0; it < iterations; ++it)
+    {
+        int id = it % windowsCount;
+        auto start = Clock::now();
+
+        layout = title = Clock::time_point();
+        bench.setActiveWindow(windows[id]);
+
+        if(! bench.waitEvents(windows[id], id % 2, layout, title, 2000))
+            timeouts++;
+
+        if(layout != Clock::time_point())
+            layoutLatency.push_back(std::chrono::duration<double, std::micro>(layout - start).count());
+
+        if(title != Clock::time_point())
+            titleLatency.push_back(std::chrono::duration<double, std::micro>(title - start).count());
+
+        // the trailing title writes
+        bench.drainEvents(20);
+    }
+
+    auto stats1 = bench.stats(statsPath, 2000);
+    auto switches1 = processSwitches(qxkb5.processId());
+
+    // idle: the stats request only
+    QThread::sleep(idleSeconds);
+
+    auto stats2 = bench.stats(statsPath, 2000);
+    auto switches2 = processSwitches(qxkb5.processId());
+
+    processStop(qxkb5);
+    processStop(xvfb);
+
+    QJsonObject idle;
+    idle.insert("seconds", idleSeconds);
+    idle.insert("wakeups_per_second", jsonDelta(stats1, stats2, "wakeups", idleSeconds));
+    idle.insert("context_switches_per_second", static_cast<double>(switches2 - switches1) / idleSeconds);
+
+    QJsonObject res;
+    res.insert("iterations", iterations);
+    res.insert("timeouts", timeouts);
+    res.insert("windows", windowsCount);
+    res.insert("layout_us", latencyJson(layoutLatency));
+    res.insert("title_us", latencyJson(titleLatency));
+    res.insert("replies_per_event", jsonDelta(stats0, stats1, "replies", iterations));
+    res.insert("wakeups_per_event", jsonDelta(stats0, stats1, "wakeups", iterations));
+    res.insert("context_switches_per_event", static_cast<double>(switches1 - switches0) / iterations);
+    res.insert("idle", idle);
+    res.insert("qxkb5", stats2);
+
+    QFile output(args.at(3));
+    if(! output.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "error open file" << args.at(3);
+        return 1;
+    }
+
+    output.write(QJsonDocument(res).toJson());
+
+    return timeouts < iterations ? 0 : 1;
+}